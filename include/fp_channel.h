@@ -0,0 +1,482 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_CHANNEL_H_
+#define _FP_CHANNEL_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+#include "fp_stream.h"
+#include "fp_chunked.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#if FP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace fp {
+
+// Values a pipeline stage hands on at a time, and batches in flight
+// between two stages
+#if !defined(FP_PIPELINE_BATCH)
+#define FP_PIPELINE_BATCH 256
+#endif
+#if !defined(FP_PIPELINE_DEPTH)
+#define FP_PIPELINE_DEPTH 8
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Channels
+///////////////////////////////////////////////////////////////////////////
+
+// Waiting on the other end of a channel: spin briefly, then yield the
+// core, then sleep, so a stage stalled on slow I/O does not burn a core
+class __backoff__ {
+public:
+  __backoff__() : mCount(0) { }
+
+  void wait() {
+    if (mCount < 64) {
+#if FP_SSE2
+      _mm_pause();
+#endif
+    } else if (mCount < 256) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    ++mCount;
+  }
+
+private:
+  unsigned mCount;
+};
+
+inline size_t __channelSlots__(size_t capacity) {
+  size_t slots = 2;
+  while (slots < capacity) slots *= 2;
+  return slots;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// spsc_channel
+
+// A bounded queue between one producing and one consuming thread, as a
+// ring of at least capacity slots.  Neither side takes a lock: each owns
+// one index and keeps a copy of the other's, reloading it only when the
+// ring looks full or empty.  Once closed, push fails and pop drains what
+// is left.
+template<typename T>
+class spsc_channel {
+public:
+  typedef T value_type;
+
+  explicit spsc_channel(size_t capacity)
+    : mMask(__channelSlots__(capacity) - 1), mSlots(new T[mMask + 1]),
+      mHead(0), mTailCopy(0), mTail(0), mHeadCopy(0), mClosed(false) { }
+
+  // Moves t in if there is room
+  bool tryPush(T& t) {
+    const size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mHeadCopy > mMask) {
+      mHeadCopy = mHead.load(std::memory_order_acquire);
+      if (tail - mHeadCopy > mMask)
+        return false;
+    }
+    mSlots[tail & mMask] = std::move(t);
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryPop(T& t) {
+    const size_t head = mHead.load(std::memory_order_relaxed);
+    if (head == mTailCopy) {
+      mTailCopy = mTail.load(std::memory_order_acquire);
+      if (head == mTailCopy)
+        return false;
+    }
+    t = std::move(mSlots[head & mMask]);
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Waits for room; false if the channel is closed
+  bool push(T t) {
+    for (__backoff__ b; !mClosed.load(std::memory_order_acquire); b.wait()) {
+      if (tryPush(t))
+        return true;
+    }
+    return false;
+  }
+
+  // Waits for a value; false once the channel is closed and empty
+  bool pop(T& t) {
+    for (__backoff__ b; ; b.wait()) {
+      if (tryPop(t))
+        return true;
+      if (mClosed.load(std::memory_order_acquire))
+        return tryPop(t);
+    }
+  }
+
+  void close()        { mClosed.store(true, std::memory_order_release); }
+  bool closed() const { return mClosed.load(std::memory_order_acquire); }
+
+private:
+  spsc_channel(const spsc_channel&);
+  spsc_channel& operator=(const spsc_channel&);
+
+  const size_t          mMask;
+  std::unique_ptr<T[]>  mSlots;
+
+  // Each side's index and copy share a cache line away from the other's
+  char                  mPad0[64];
+  std::atomic<size_t>   mHead;
+  size_t                mTailCopy;
+  char                  mPad1[64];
+  std::atomic<size_t>   mTail;
+  size_t                mHeadCopy;
+  char                  mPad2[64];
+  std::atomic<bool>     mClosed;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// mpmc_channel
+
+// A bounded queue for any number of producers and consumers.  Each slot
+// carries a sequence number saying whose turn it is: a producer claims
+// the slot at the tail when its number matches the tail, a consumer the
+// slot at the head once its number is one past the head, so a side only
+// contends with its own kind on one index.  Close it once every producer
+// is done.
+template<typename T>
+class mpmc_channel {
+public:
+  typedef T value_type;
+
+  explicit mpmc_channel(size_t capacity)
+    : mMask(__channelSlots__(capacity) - 1), mSlots(new slot[mMask + 1]),
+      mHead(0), mTail(0), mClosed(false) {
+    for (size_t i = 0; i <= mMask; ++i)
+      mSlots[i].turn.store(i, std::memory_order_relaxed);
+  }
+
+  bool tryPush(T& t) {
+    size_t tail = mTail.load(std::memory_order_relaxed);
+    for (;;) {
+      slot& s = mSlots[tail & mMask];
+      const ptrdiff_t lag = (ptrdiff_t)(s.turn.load(std::memory_order_acquire) - tail);
+      if (lag == 0) {
+        if (mTail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+          s.value = std::move(t);
+          s.turn.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        return false;
+      } else {
+        tail = mTail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool tryPop(T& t) {
+    size_t head = mHead.load(std::memory_order_relaxed);
+    for (;;) {
+      slot& s = mSlots[head & mMask];
+      const ptrdiff_t lag = (ptrdiff_t)(s.turn.load(std::memory_order_acquire) - (head + 1));
+      if (lag == 0) {
+        if (mHead.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+          t = std::move(s.value);
+          s.turn.store(head + mMask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        return false;
+      } else {
+        head = mHead.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool push(T t) {
+    for (__backoff__ b; !mClosed.load(std::memory_order_acquire); b.wait()) {
+      if (tryPush(t))
+        return true;
+    }
+    return false;
+  }
+
+  bool pop(T& t) {
+    for (__backoff__ b; ; b.wait()) {
+      if (tryPop(t))
+        return true;
+      if (mClosed.load(std::memory_order_acquire))
+        return tryPop(t);
+    }
+  }
+
+  void close()        { mClosed.store(true, std::memory_order_release); }
+  bool closed() const { return mClosed.load(std::memory_order_acquire); }
+
+private:
+  mpmc_channel(const mpmc_channel&);
+  mpmc_channel& operator=(const mpmc_channel&);
+
+  struct slot {
+    std::atomic<size_t> turn;
+    T                   value;
+  };
+
+  const size_t            mMask;
+  std::unique_ptr<slot[]> mSlots;
+  char                    mPad0[64];
+  std::atomic<size_t>     mHead;
+  char                    mPad1[64];
+  std::atomic<size_t>     mTail;
+  char                    mPad2[64];
+  std::atomic<bool>       mClosed;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Pipelines
+///////////////////////////////////////////////////////////////////////////
+
+// The threads of one pipeline and how it ends.  A stage that throws
+// cancels the rest, and the exception is thrown to whoever reads the end
+// of the pipeline.  When the last handle on the pipeline goes, stages
+// still running are cancelled and joined; a source blocked reading its
+// input is waited for.
+class __pipeline_state__ {
+public:
+  __pipeline_state__() : mCancelled(false) { }
+
+  ~__pipeline_state__() {
+    cancel();
+    for (size_t i = 0; i < mThreads.size(); ++i)
+      mThreads[i].join();
+  }
+
+  // Runs body on a thread of its own, closing out when it is done
+  template<typename Body, typename Channel>
+  void spawn(Body body, std::shared_ptr<Channel> out) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mClosers.push_back([out]() { out->close(); });
+    // The state joins the thread before it goes, so this outlives it
+    mThreads.push_back(std::thread([this, body, out]() {
+      try {
+        body();
+      } catch (...) {
+        fail(std::current_exception());
+      }
+      out->close();
+    }));
+  }
+
+  bool cancelled() const { return mCancelled.load(std::memory_order_acquire); }
+
+  void cancel() {
+    mCancelled.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (size_t i = 0; i < mClosers.size(); ++i)
+      mClosers[i]();
+  }
+
+  void fail(std::exception_ptr e) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (!mError) mError = e;
+    }
+    cancel();
+  }
+
+  void rethrow() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mError)
+      std::rethrow_exception(mError);
+  }
+
+private:
+  __pipeline_state__(const __pipeline_state__&);
+  __pipeline_state__& operator=(const __pipeline_state__&);
+
+  std::atomic<bool>                              mCancelled;
+  std::mutex                                     mMutex;
+  types<std::thread>::list                       mThreads;
+  types< std::function<void()> >::list           mClosers;
+  std::exception_ptr                             mError;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// pipeline
+
+// A chain of stages, each on a thread of its own, joined by bounded
+// channels that carry batches of values: a stage that gets ahead waits for
+// the next one, and the cost of a channel is paid once a batch.  map and
+// filter of a pipeline add a stage; list, foldl, toStream and chunked read
+// its end on the calling thread.  Each pipeline value is read once, by the
+// stage or terminal it is handed to.  pipelined starts one.
+// Example: fp::list( fp::map( transform, fp::map( parse, fp::pipelined( lines ) ) ) )
+template<typename T>
+class pipeline {
+public:
+  typedef T                                  value_type;
+  typedef typename types<T>::list            batch;
+  typedef spsc_channel<batch>                channel;
+
+  pipeline(std::shared_ptr<__pipeline_state__> state, std::shared_ptr<channel> out, size_t depth)
+    : mState(std::move(state)), mOut(std::move(out)), mDepth(depth),
+      mTaken(std::make_shared< std::atomic<bool> >(false)) { }
+
+  // The channel at the end, for the one stage or terminal reading it
+  std::shared_ptr<channel> take() const {
+    if (mTaken->exchange(true))
+      throw std::logic_error("pipeline: already read");
+    return mOut;
+  }
+
+  const std::shared_ptr<__pipeline_state__>& state() const { return mState; }
+  // Batches each channel of the pipeline holds
+  size_t depth() const { return mDepth; }
+
+private:
+  std::shared_ptr<__pipeline_state__>        mState;
+  std::shared_ptr<channel>                   mOut;
+  size_t                                     mDepth;
+  std::shared_ptr< std::atomic<bool> >       mTaken;
+};
+
+// The values of s, read on a thread of its own batchSize at a time, with
+// up to depth batches waiting between this and each later stage
+template<typename T>
+inline pipeline<T> pipelined(stream<T> s, size_t batchSize = FP_PIPELINE_BATCH, size_t depth = FP_PIPELINE_DEPTH) {
+  typedef typename pipeline<T>::batch   batch;
+  typedef typename pipeline<T>::channel channel;
+  let state = std::make_shared<__pipeline_state__>();
+  let out   = std::make_shared<channel>(depth);
+  const __pipeline_state__* st = state.get();
+  state->spawn([=]() {
+    while (!st->cancelled()) {
+      batch b;
+      b.reserve(batchSize);
+      for (Maybe<T> t; b.size() < batchSize && (t = s()); )
+        b.push_back(std::move(*t));
+      if (b.empty() || !out->push(std::move(b)))
+        return;
+    }
+  }, out);
+  return pipeline<T>(state, out, depth);
+}
+
+// The batches of c, as they come
+template<typename T>
+inline pipeline<T> pipelined(chunked_stream<T> c, size_t depth = FP_PIPELINE_DEPTH) {
+  typedef typename pipeline<T>::batch   batch;
+  typedef typename pipeline<T>::channel channel;
+  let state = std::make_shared<__pipeline_state__>();
+  let out   = std::make_shared<channel>(depth);
+  const __pipeline_state__* st = state.get();
+  state->spawn([=]() {
+    for (batch b; !st->cancelled() && c(b); ) {
+      if (!out->push(std::move(b)))
+        return;
+    }
+  }, out);
+  return pipeline<T>(state, out, depth);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// map
+
+template<typename F, typename T>
+inline auto map(F f, pipeline<T> p) -> pipeline< nonconstref_type_of(decltype(f(std::declval<T>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>()))) U;
+  typedef typename pipeline<U>::channel channel;
+  let in  = p.take();
+  let out = std::make_shared<channel>(p.depth());
+  const __pipeline_state__* st = p.state().get();
+  p.state()->spawn([=]() {
+    for (typename pipeline<T>::batch b; !st->cancelled() && in->pop(b); ) {
+      typename pipeline<U>::batch result(b.size());
+      for (size_t i = 0; i < b.size(); ++i)
+        result[i] = f(b[i]);
+      if (!out->push(std::move(result)))
+        return;
+    }
+  }, out);
+  return pipeline<U>(p.state(), out, p.depth());
+}
+
+///////////////////////////////////////////////////////////////////////////
+// filter
+
+template<typename F, typename T>
+inline pipeline<T> filter(F f, pipeline<T> p) {
+  typedef typename pipeline<T>::channel channel;
+  let in  = p.take();
+  let out = std::make_shared<channel>(p.depth());
+  const __pipeline_state__* st = p.state().get();
+  p.state()->spawn([=]() {
+    for (typename pipeline<T>::batch b; !st->cancelled() && in->pop(b); ) {
+      typename pipeline<T>::batch kept;
+      kept.reserve(b.size());
+      for (size_t i = 0; i < b.size(); ++i) {
+        if (f(b[i]))
+          kept.push_back(std::move(b[i]));
+      }
+      if (!kept.empty() && !out->push(std::move(kept)))
+        return;
+    }
+  }, out);
+  return pipeline<T>(p.state(), out, p.depth());
+}
+
+///////////////////////////////////////////////////////////////////////////
+// chunked / toStream
+
+// The end of the pipeline, a batch at a time on the calling thread
+template<typename T>
+inline chunked_stream<T> chunked(pipeline<T> p) {
+  let state = p.state();
+  let in    = p.take();
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    if (in->pop(b))
+      return true;
+    state->rethrow();
+    return false;
+  });
+}
+
+template<typename T>
+inline stream<T> toStream(pipeline<T> p) {
+  return unchunked(chunked(p));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// list / foldl
+
+template<typename T>
+inline typename types<T>::list list(pipeline<T> p) {
+  return list(chunked(p));
+}
+
+template<typename F, typename T, typename U>
+inline T foldl(F f, T t, pipeline<U> p) {
+  return foldl(f, t, chunked(p));
+}
+
+} /* namespace fp */
+
+#endif /* _FP_CHANNEL_H_ */
@@ -0,0 +1,312 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_CHUNKED_H_
+#define _FP_CHUNKED_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+#include "fp_stream.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+
+namespace fp {
+
+// Values per batch read from a source that does not come in batches
+#if !defined(FP_CHUNK_SIZE)
+#define FP_CHUNK_SIZE 1024
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Chunked streams
+///////////////////////////////////////////////////////////////////////////
+
+// A stream read a batch at a time: each call fills a list with the next
+// values and returns true, then returns false once the stream is done.
+// Each stage handles a whole batch per call in a plain loop over a buffer
+// it keeps, so the cost of a call is shared by the batch and cheap
+// functions can be vectorized by the compiler.  Like streams, chunked
+// streams are single pass and copies share their position; stages keep
+// the batch size of their source.
+// Example: fp::foldl( std::plus<int>(), 0, fp::map( square, fp::chunked( numbers ) ) )
+template<typename T>
+class chunked_stream {
+public:
+  typedef T                               value_type;
+  typedef typename types<T>::list         batch;
+  typedef std::function<bool(batch&)>     generator;
+
+  chunked_stream() { }
+  explicit chunked_stream(generator g) : mNext(std::make_shared<generator>(std::move(g))) { }
+
+  // Replaces the contents of b with the next batch, which is never empty
+  bool operator()(batch& b) const {
+    b.clear();
+    return mNext && (*mNext)(b);
+  }
+
+private:
+  std::shared_ptr<generator> mNext;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// chunked
+
+template<typename B, typename It>
+inline void __fillBatch__(B& b, It& it, It end, size_t n, std::random_access_iterator_tag) {
+  const It last = it + (ptrdiff_t)std::min<size_t>(n, end - it);
+  b.assign(it, last);
+  it = last;
+}
+template<typename B, typename It>
+inline void __fillBatch__(B& b, It& it, It end, size_t n, std::input_iterator_tag) {
+  for (size_t i = 0; i < n && it != end; ++i, ++it)
+    b.push_back(*it);
+}
+
+// The values of a list, n at a time
+template<typename C>
+inline fp_enable_if_container(C, chunked_stream< value_type_of(C) >) chunked(C c, size_t n = FP_CHUNK_SIZE) {
+  typedef value_type_of(C) T;
+  let source = std::make_shared<C>(std::move(c));
+  let it     = std::make_shared<typename C::const_iterator>(source->begin());
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    typedef typename C::const_iterator It;
+    __fillBatch__(b, *it, It(source->end()), n, typename std::iterator_traits<It>::iterator_category());
+    return !b.empty();
+  });
+}
+
+// The values of a stream, read one at a time and passed on n at a time
+template<typename T>
+inline chunked_stream<T> chunked(stream<T> s, size_t n = FP_CHUNK_SIZE) {
+  let done = std::make_shared<bool>(false);
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    for (Maybe<T> t; b.size() < n && !*done; ) {
+      t = s();
+      if (t) b.push_back(std::move(*t));
+      else   *done = true;
+    }
+    return !b.empty();
+  });
+}
+
+// The values of a generator, such as a thunk, n at a time
+template<typename T>
+inline chunked_stream<T> chunked(std::function<T()> f, size_t n = FP_CHUNK_SIZE) {
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    b.resize(n);
+    for (size_t i = 0; i < n; ++i)
+      b[i] = f();
+    return true;
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// unchunked
+
+// The values one at a time, for the stream combinators
+template<typename T>
+inline stream<T> unchunked(chunked_stream<T> c) {
+  let b = std::make_shared<typename types<T>::list>();
+  let i = std::make_shared<size_t>(0);
+  return stream<T>([=]() -> Maybe<T> {
+    if (*i == b->size()) {
+      if (!c(*b))
+        return Maybe<T>();
+      *i = 0;
+    }
+    return Maybe<T>((*b)[(*i)++]);
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// list
+
+template<typename T>
+inline typename types<T>::list list(chunked_stream<T> c) {
+  typename types<T>::list result, b;
+  while (c(b))
+    result.insert(result.end(), extent(b));
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// map
+
+template<typename F, typename T>
+inline auto map(F f, chunked_stream<T> c) -> chunked_stream< nonconstref_type_of(decltype(f(std::declval<T>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>()))) U;
+  let in = std::make_shared<typename types<T>::list>();
+  return chunked_stream<U>([=](typename types<U>::list& b) {
+    if (!c(*in))
+      return false;
+    const typename types<T>::list& x = *in;
+    const size_t n = x.size();
+    b.resize(n);
+    for (size_t i = 0; i < n; ++i)
+      b[i] = f(x[i]);
+    return true;
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// filter
+
+template<typename F, typename T>
+inline chunked_stream<T> filter(F f, chunked_stream<T> c) {
+  let in = std::make_shared<typename types<T>::list>();
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    while (b.empty()) {
+      if (!c(*in))
+        return false;
+      // Writes every value and keeps those that pass, without a branch
+      const typename types<T>::list& x = *in;
+      const size_t n = x.size();
+      b.resize(n);
+      size_t kept = 0;
+      for (size_t i = 0; i < n; ++i) {
+        b[kept] = x[i];
+        kept += f(x[i]) ? 1 : 0;
+      }
+      b.resize(kept);
+    }
+    return true;
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// scanl
+
+// t, then each running total, as for lists
+template<typename F, typename T, typename U>
+inline chunked_stream<T> scanl(F f, T t, chunked_stream<U> c) {
+  struct state {
+    explicit state(T t) : total(std::move(t)), started(false), done(false) { }
+    T                            total;
+    bool                         started, done;
+    typename types<U>::list      in;
+  };
+  let s = std::make_shared<state>(std::move(t));
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    if (s->done)
+      return false;
+    if (!s->started) {
+      s->started = true;
+      b.push_back(s->total);
+    }
+    if (!c(s->in)) {
+      s->done = true;
+      return !b.empty();
+    }
+    const size_t first = b.size(), n = s->in.size();
+    b.resize(first + n);
+    T total = s->total;
+    for (size_t i = 0; i < n; ++i)
+      b[first + i] = total = f(total, s->in[i]);
+    s->total = std::move(total);
+    return true;
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// zipWith
+
+// Batches of the two sides need not line up: each output batch is as long
+// as the shorter run of values left on either side
+template<typename F, typename T, typename U>
+inline auto zipWith(F f, chunked_stream<T> t, chunked_stream<U> u)
+  -> chunked_stream< nonconstref_type_of(decltype(f(std::declval<T>(), std::declval<U>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>(), std::declval<U>()))) V;
+  struct state {
+    state() : i(0), j(0) { }
+    typename types<T>::list ts;
+    typename types<U>::list us;
+    size_t                  i, j;
+  };
+  let s = std::make_shared<state>();
+  return chunked_stream<V>([=](typename types<V>::list& b) {
+    if (s->i == s->ts.size()) {
+      if (!t(s->ts)) return false;
+      s->i = 0;
+    }
+    if (s->j == s->us.size()) {
+      if (!u(s->us)) return false;
+      s->j = 0;
+    }
+    const size_t n = std::min(s->ts.size() - s->i, s->us.size() - s->j);
+    const typename types<T>::list& x = s->ts;
+    const typename types<U>::list& y = s->us;
+    b.resize(n);
+    for (size_t k = 0; k < n; ++k)
+      b[k] = f(x[s->i + k], y[s->j + k]);
+    s->i += n;
+    s->j += n;
+    return true;
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// take
+
+template<typename T>
+inline chunked_stream<T> take(size_t n, chunked_stream<T> c) {
+  let left = std::make_shared<size_t>(n);
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    if (*left == 0 || !c(b))
+      return false;
+    if (b.size() > *left)
+      b.resize(*left);
+    *left -= b.size();
+    return true;
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// takeWhile
+
+template<typename F, typename T>
+inline chunked_stream<T> takeWhile(F f, chunked_stream<T> c) {
+  let done = std::make_shared<bool>(false);
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    if (*done || !c(b))
+      return false;
+    size_t n = 0;
+    while (n < b.size() && f(b[n])) ++n;
+    if (n < b.size()) {
+      *done = true;
+      b.resize(n);
+    }
+    return n > 0;
+  });
+}
+
+// The values while f holds, as a list
+template<typename F, typename T>
+inline typename types<T>::list takeWhileT(F f, chunked_stream<T> c) {
+  return list(takeWhile(f, c));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// foldl
+
+template<typename F, typename T, typename U>
+inline T foldl(F f, T t, chunked_stream<U> c) {
+  typename types<U>::list b;
+  while (c(b)) {
+    for (size_t i = 0, n = b.size(); i < n; ++i)
+      t = f(t, b[i]);
+  }
+  return t;
+}
+
+} /* namespace fp */
+
+#endif /* _FP_CHUNKED_H_ */
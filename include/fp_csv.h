@@ -0,0 +1,405 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_CSV_H_
+#define _FP_CSV_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+#include "fp_parallel.h"
+#include "fp_read.h"
+#include "fp_string_ref.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <string.h>
+#include <type_traits>
+
+#if FP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Delimited files
+///////////////////////////////////////////////////////////////////////////
+
+// Text is split into chunks of this many bytes, parsed in parallel
+#if !defined(FP_CSV_CHUNK)
+#define FP_CSV_CHUNK (1 << 20)
+#endif
+
+struct csv_options {
+  csv_options(char delim_ = ',', bool header_ = true, char quote_ = '"')
+    : delim(delim_), quote(quote_), header(header_) { }
+  char delim;
+  char quote;
+  bool header;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Scanning
+
+// First delim or newline in [p,last)
+inline char* __csvFieldEnd__(char* p, char* last, char delim) {
+#if FP_SSE2
+  const __m128i d  = _mm_set1_epi8(delim);
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; last - p >= 16; p += 16) {
+    const __m128i x = _mm_loadu_si128((const __m128i*)p);
+    const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, d), _mm_cmpeq_epi8(x, nl)));
+    if (mask)
+      return p + __ctz64__((uint64_t)mask);
+  }
+#endif
+  while (p != last && *p != delim && *p != '\n') ++p;
+  return p;
+}
+
+// Where the scan of a record is: at the start of a field, in an unquoted
+// field or after a quoted one, in a quoted field, or just past a quote in
+// a quoted field
+enum __csv_state__ {
+  CSV_FIELD,
+  CSV_UNQUOTED,
+  CSV_QUOTED,
+  CSV_QUOTE_SEEN,
+};
+
+// Advances p past the next newline that ends a record, as __csvRecord__
+// reads them: a quote is only special at the start of a field, and inside
+// one until the quote that closes it.  False, with p at last, if none does.
+inline bool __csvNextRecord__(const char*& p, const char* last, const csv_options& o, __csv_state__& s) {
+  while (p != last) {
+    if (s == CSV_QUOTED) {
+      const char* q = (const char*)memchr(p, o.quote, last - p);
+      p = q ? q + 1 : last;
+      if (q) s = CSV_QUOTE_SEEN;
+      continue;
+    }
+    if (s == CSV_UNQUOTED) {
+      p = __csvFieldEnd__((char*)p, (char*)last, o.delim);
+      if (p == last)
+        return false;
+    }
+    const char c = *p++;
+    if (c == '\n') {
+      s = CSV_FIELD;
+      return true;
+    }
+    if (c == o.delim)
+      s = CSV_FIELD;
+    else if (c == o.quote && s != CSV_UNQUOTED)
+      s = CSV_QUOTED;
+    else
+      s = CSV_UNQUOTED;
+  }
+  return false;
+}
+
+// The state of the scan at last, from state s at p
+inline __csv_state__ __csvScan__(const char* p, const char* last, const csv_options& o, __csv_state__ s) {
+  while (__csvNextRecord__(p, last, o, s)) { }
+  return s;
+}
+
+// Splits the record at p into fields, unescaping quoted fields in place;
+// returns the start of the next record.  Quotes are only special at the
+// start of a field, and a "\r\n" line ending is treated as "\n".
+inline char* __csvRecord__(char* p, char* last, const csv_options& o, types<string_ref>::list& fields) {
+  fields.clear();
+  for (;;) {
+    if (p != last && *p == o.quote) {
+      char* start = ++p;
+      char* out   = start;
+      for (;;) {
+        char* q = (char*)memchr(p, o.quote, last - p);
+        if (!q) q = last;
+        if (out != p) memmove(out, p, q - p);
+        out += q - p;
+        p = q == last ? last : q + 1;
+        if (p == last || *p != o.quote)
+          break;
+        *out++ = *p++;
+      }
+      fields.push_back(string_ref(start, out));
+      p = __csvFieldEnd__(p, last, o.delim);
+    } else {
+      char* e = __csvFieldEnd__(p, last, o.delim);
+      char* fieldLast = e;
+      if ((e == last || *e == '\n') && fieldLast != p && fieldLast[-1] == '\r')
+        --fieldLast;
+      fields.push_back(string_ref(p, fieldLast));
+      p = e;
+    }
+    if (p == last)
+      return last;
+    if (*p++ == '\n')
+      return p;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// csv_table
+
+class csv_table;
+inline csv_table __csvTable__(std::shared_ptr<string> text, const csv_options& o, const csv_table* previous);
+
+// Columns of a delimited file, each a list of fields viewing the table's
+// own copy of the text.  column<T> parses a column into a types<T>::list.
+// Rows with too few fields are padded with empty fields; extra fields are
+// dropped.
+class csv_table {
+public:
+  typedef types<string_ref>::list field_list;
+
+  csv_table() : mText(std::make_shared<string>()) { }
+
+  size_t rows()    const { return mColumns.empty() ? 0 : mColumns[0].size(); }
+  size_t columns() const { return mColumns.size(); }
+
+  // Header names, or empty if the file had no header
+  const types<string>::list& names() const { return mNames; }
+
+  Maybe<size_t> columnIndex(const string& name) const {
+    let it = std::find(extent(mNames), name);
+    return it != end(mNames) ? Maybe<size_t>((size_t)(it - begin(mNames))) : Maybe<size_t>();
+  }
+
+  const field_list& fields(size_t i) const { return mColumns[i]; }
+
+  // The column as T, or Nothing if any field is not a T
+  template<typename T>
+  Maybe<typename types<T>::list> column(size_t i) const {
+    typedef typename types<T>::list list;
+    // Packed bools share words, so they are parsed a byte each
+    typedef typename std::conditional<std::is_same<T, bool>::value, char, T>::type slot;
+    const field_list& src = mColumns[i];
+    typename types<slot>::list result(src.size());
+    std::atomic<bool> ok(true);
+    parallelFor(src.size(), [&](size_t first, size_t last) {
+      for (size_t j = first; j < last && ok; ++j) {
+        if (!readField(src[j], result[j], (T*)nullptr))
+          ok = false;
+      }
+    }, FP_PARALLEL_GRAIN * 16);
+    return ok ? Maybe<list>(fromSlots(result, (T*)nullptr)) : Maybe<list>();
+  }
+
+  template<typename T>
+  Maybe<typename types<T>::list> column(const string& name) const {
+    let i = columnIndex(name);
+    return i ? column<T>(*i) : Maybe<typename types<T>::list>();
+  }
+
+private:
+  friend class csv_reader;
+  friend csv_table __csvTable__(std::shared_ptr<string>, const csv_options&, const csv_table*);
+
+  template<typename S, typename T>
+  static bool readField(const string_ref& s, S& t, T*) {
+    let m = read<T>(s);
+    t = *m;
+    return m.valid();
+  }
+  static bool readField(const string_ref& s, string& t, string*)         { t = s.str(); return true; }
+  static bool readField(const string_ref& s, string_ref& t, string_ref*) { t = s;       return true; }
+
+  template<typename T>
+  static typename types<T>::list fromSlots(typename types<T>::list& r, T*) { return std::move(r); }
+  static types<bool>::list fromSlots(types<char>::list& r, bool*) { return types<bool>::list(extent(r)); }
+
+  std::shared_ptr<string>    mText;
+  types<string>::list        mNames;
+  types<field_list>::list    mColumns;
+};
+
+// Parses text into a table; a previous batch, if given, fixes the names and
+// the number of columns.
+// Chunk boundaries land on record boundaries by scanning each chunk from
+// every state it could start in, in parallel, then chaining the chunks'
+// end states from the start of the text.
+inline csv_table __csvTable__(std::shared_ptr<string> text, const csv_options& o, const csv_table* previous) {
+  csv_table table;
+  table.mText = text;
+  char* first = &(*text)[0];
+  char* last  = first + text->size();
+
+  // The first record is parsed here, unescaping it in place, to count the
+  // columns; without a header it is also the first row
+  types<string_ref>::list fields;
+  size_t columns = 0;
+  if (previous) {
+    table.mNames = previous->mNames;
+    columns = previous->columns();
+  } else {
+    while (first != last && (*first == '\n' || *first == '\r')) ++first;
+    if (first == last)
+      return table;
+    first = __csvRecord__(first, last, o, fields);
+    columns = fields.size();
+    if (o.header) {
+      std::transform(extent(fields), back(table.mNames), [](const string_ref& f) { return f.str(); });
+      fields.clear();
+    }
+  }
+  table.mColumns.resize(columns);
+  for (size_t i = 0; i < fields.size(); ++i)
+    table.mColumns[i].push_back(fields[i]);
+  if (first == last || columns == 0)
+    return table;
+
+  const size_t chunks = ((size_t)(last - first) + FP_CSV_CHUNK - 1) / FP_CSV_CHUNK;
+  const size_t chunkSize = (last - first + chunks - 1) / chunks;
+
+  const __csv_state__ states[] = { CSV_FIELD, CSV_UNQUOTED, CSV_QUOTED, CSV_QUOTE_SEEN };
+  types< std::array<__csv_state__, 4> >::list ends(chunks);
+  parallelFor(chunks, [&](size_t c0, size_t c1) {
+    for (size_t c = c0; c < c1; ++c) {
+      const char* p = first + std::min(c * chunkSize, (size_t)(last - first));
+      const char* e = std::min(p + chunkSize, (const char*)last);
+      for (size_t k = 0; k < 4; ++k)
+        ends[c][k] = __csvScan__(p, e, o, states[k]);
+    }
+  }, 1);
+  types<__csv_state__>::list entry(chunks, CSV_FIELD);
+  for (size_t c = 1; c < chunks; ++c)
+    entry[c] = ends[c - 1][entry[c - 1]];
+
+  types<char*>::list starts(chunks + 1, last);
+  starts[0] = first;
+  parallelFor(chunks, [&](size_t c0, size_t c1) {
+    for (size_t c = std::max<size_t>(c0, 1); c < c1; ++c) {
+      const char* p = first + std::min(c * chunkSize, (size_t)(last - first));
+      __csv_state__ s = entry[c];
+      __csvNextRecord__(p, last, o, s);
+      starts[c] = first + (p - first);
+    }
+  }, 1);
+
+  types< types<csv_table::field_list>::list >::list parts(chunks, types<csv_table::field_list>::list(columns));
+  parallelFor(chunks, [&](size_t c0, size_t c1) {
+    types<string_ref>::list record;
+    for (size_t c = c0; c < c1; ++c) {
+      char* p = starts[c];
+      char* e = std::max(starts[c], starts[c + 1]);
+      while (p < e) {
+        if (*p == '\n' || (*p == '\r' && p + 1 != e && p[1] == '\n')) {
+          p += *p == '\n' ? 1 : 2;
+          continue;
+        }
+        p = __csvRecord__(p, e, o, record);
+        for (size_t i = 0; i < columns; ++i)
+          parts[c][i].push_back(i < record.size() ? record[i] : string_ref());
+      }
+    }
+  }, 1);
+
+  for (size_t i = 0; i < columns; ++i) {
+    size_t n = 0;
+    for (size_t c = 0; c < chunks; ++c) n += parts[c][i].size();
+    table.mColumns[i].reserve(table.mColumns[i].size() + n);
+    for (size_t c = 0; c < chunks; ++c)
+      table.mColumns[i].insert(end(table.mColumns[i]), extent(parts[c][i]));
+  }
+  return table;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// readCsv
+
+// Example: fromJust(readCsv(text).column<double>("price"))
+inline csv_table readCsv(string text, const csv_options& o = csv_options()) {
+  return __csvTable__(std::make_shared<string>(std::move(text)), o, nullptr);
+}
+
+inline csv_table readCsv(std::istream& is, const csv_options& o = csv_options()) {
+  return readCsv(string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()), o);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// csv_reader
+
+// Reads a delimited stream as a sequence of tables of whole records, about
+// blockSize bytes at a time, so files larger than memory can be folded
+// over.  Every batch has the names of the first.
+// Example: while (let batch = reader.next()) { ... (*batch).column<int>(0) ... }
+class csv_reader {
+public:
+  csv_reader(std::istream& is, const csv_options& o = csv_options(), size_t blockSize = 1 << 24)
+    : mStream(is), mOptions(o), mBlockSize(blockSize), mFirst(true), mScanned(0), mSplit(0), mState(CSV_FIELD) { }
+
+  Maybe<csv_table> next() {
+    for (;;) {
+      const size_t carry = mPending.size();
+      mPending.resize(carry + mBlockSize);
+      mStream.read(&mPending[carry], mBlockSize);
+      const size_t n = (size_t)mStream.gcount();
+      mPending.resize(carry + n);
+      if (mPending.empty())
+        return Nothing();
+
+      // Last record boundary; the buffer always starts on a record, and the
+      // scan picks up where the last one stopped
+      const char* first = mPending.data();
+      const char* last  = first + mPending.size();
+      const char* split = last;
+      if (n != 0) {
+        const char* p = first + mScanned;
+        split = first + mSplit;
+        while (__csvNextRecord__(p, last, mOptions, mState))
+          split = p;
+        mScanned = last - first;
+        mSplit   = split - first;
+        if (split == first)
+          continue;
+      }
+
+      let text = std::make_shared<string>(first, split);
+      mPending.erase(0, split - first);
+      mScanned -= std::min(mScanned, mSplit);
+      mSplit    = 0;
+      if (n == 0) {
+        mScanned = 0;
+        mState   = CSV_FIELD;
+      }
+      csv_table table = __csvTable__(text, mOptions, mFirst ? nullptr : &mShape);
+      if (mFirst) {
+        mFirst = false;
+        mShape.mNames = table.mNames;
+        mShape.mColumns.resize(table.columns());
+      }
+      return Maybe<csv_table>(std::move(table));
+    }
+  }
+
+  const types<string>::list& names() const { return mShape.names(); }
+
+private:
+  csv_reader(const csv_reader&);
+  csv_reader& operator=(const csv_reader&);
+
+  std::istream&       mStream;
+  csv_options         mOptions;
+  size_t              mBlockSize;
+  bool                mFirst;
+  size_t              mScanned;  // Bytes of mPending scanned for records
+  size_t              mSplit;    // End of the last whole record in them
+  __csv_state__       mState;    // The scan's state at mScanned
+  string              mPending;
+  csv_table           mShape;
+};
+
+} /* namespace fp */
+
+#endif /* _FP_CSV_H_ */
@@ -12,6 +12,7 @@
 // FP_DECLVAL  - Whether the compiler has a built-in declval function
 // FP_VARIADIC - Whether the compiler supports variadic templates
 // FP_COMPOUND - Whether the compiler properly compiles compound composition
+// FP_THREAD_LOCAL - Thread-local storage specifier
 
 #if defined(_MSC_VER)
 #define FP_INITIALIZER 0
@@ -24,18 +25,25 @@
 #define FP_DECLVAL  1
 #define FP_NOEXCEPT noexcept
 #endif
+#if _MSC_VER >= 1900
+#define FP_THREAD_LOCAL thread_local
+#else
+#define FP_THREAD_LOCAL __declspec(thread)
+#endif
 #elif defined(__INTEL_COMPILER)
 #define FP_INITIALIZER 1
 #define FP_DECLVAL     0
 #define FP_VARIADIC    1
 #define FP_THIS_IN_RET 1
 #define FP_NOEXCEPT noexcept
-else
+#define FP_THREAD_LOCAL thread_local
+#else
 #define FP_INITIALIZER 1
 #define FP_DECLVAL     1
 #define FP_VARIADIC    1
 #define FP_THIS_IN_RET 0
 #define FP_NOEXCEPT noexcept
+#define FP_THREAD_LOCAL thread_local
 #endif
 
 #define USE_DEQUE_FOR_LISTS 0
@@ -60,6 +68,42 @@ else
 #define FP_SHIFT_OPERATOR 0
 #endif
 
+// Platform defines
+#if defined(_WIN32) && !defined(FP_WINDOWS)
+#define FP_WINDOWS 1
+#endif
+#if defined(__linux__) && !defined(FP_LINUX)
+#define FP_LINUX 1
+#endif
+
+// Instruction set defines
+#if !defined(FP_SSE2)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FP_SSE2 1
+#else
+#define FP_SSE2 0
+#endif
+#endif
+
+// Byte order; word-at-a-time string scanning assumes little-endian loads
+#if !defined(FP_LITTLE_ENDIAN)
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define FP_LITTLE_ENDIAN 1
+#else
+#define FP_LITTLE_ENDIAN 0
+#endif
+#endif
+
+// Language feature defines; generator<T> needs C++20 coroutines
+#if !defined(FP_COROUTINES)
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define FP_COROUTINES 1
+#else
+#define FP_COROUTINES 0
+#endif
+#endif
+
 // Keywords
 #define let auto
 #define extent(c)  fp::begin((c)),  fp::end((c))
@@ -0,0 +1,313 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_FORMAT_H_
+#define _FP_FORMAT_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_string_ref.h"
+
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Formatting
+///////////////////////////////////////////////////////////////////////////
+
+// show kinds, picked by show_traits
+enum {
+  SHOW_STREAM = 0,
+  SHOW_INTEGER,
+  SHOW_CHAR,
+  SHOW_FLOAT,
+  SHOW_CONTAINER,
+};
+
+template<typename T>
+struct show_traits {
+  static const int value =
+    is_container<T>::value                      ? SHOW_CONTAINER :
+    std::is_same<T,char>::value ||
+    std::is_same<T,signed char>::value ||
+    std::is_same<T,unsigned char>::value        ? SHOW_CHAR      :
+    std::is_integral<T>::value                  ? SHOW_INTEGER   :
+    std::is_floating_point<T>::value            ? SHOW_FLOAT     :
+                                                  SHOW_STREAM;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Numbers
+
+inline size_t __digits__(uint64_t v) {
+  size_t n = 1;
+  for (; v >= 10000; v /= 10000) n += 4;
+  return n + (v >= 10) + (v >= 100) + (v >= 1000);
+}
+
+// Writes v backwards ending at last, two digits at a time
+inline char* __showUnsigned__(char* last, uint64_t v) {
+  static const char pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  while (v >= 100) {
+    const size_t i = (size_t)(v % 100) * 2;
+    v /= 100;
+    *--last = pairs[i + 1];
+    *--last = pairs[i];
+  }
+  if (v >= 10) {
+    *--last = pairs[v * 2 + 1];
+    *--last = pairs[v * 2];
+  } else {
+    *--last = (char)('0' + v);
+  }
+  return last;
+}
+
+template<typename T>
+inline bool __isNegative__(T t, std::true_type)  { return t < 0; }
+template<typename T>
+inline bool __isNegative__(T,   std::false_type) { return false; }
+template<typename T>
+inline bool __isNegative__(T t) { return __isNegative__(t, std::is_signed<T>()); }
+
+template<typename T>
+inline void __showInteger__(string& s, T t) {
+  char buf[24];
+  char* last  = buf + sizeof(buf);
+  const bool negative = __isNegative__(t);
+  const uint64_t v = negative ? 0 - (uint64_t)t : (uint64_t)t;
+  char* first = __showUnsigned__(last, v);
+  if (negative) *--first = '-';
+  s.append(first, last);
+}
+
+// Shortest "%g" form that reads back as the same value.  Any decimal of at
+// most digits10 digits survives the round trip, so starting there and
+// widening to max_digits10 finds the shortest one in at most three tries.
+inline int __printFloat__(char* buf, size_t size, int digits, double t) {
+  return snprintf(buf, size, "%.*g", digits, t);
+}
+inline int __printFloat__(char* buf, size_t size, int digits, long double t) {
+  return snprintf(buf, size, "%.*Lg", digits, t);
+}
+inline double      __readFloat__(const char* buf, double)      { return strtod(buf, nullptr); }
+inline long double __readFloat__(const char* buf, long double) { return strtold(buf, nullptr); }
+
+template<typename T>
+inline void __showFloat__(string& s, T t) {
+  typedef typename select<(sizeof(T) > sizeof(double)), long double, double>::result_type wide_type;
+  const int minDigits = std::numeric_limits<T>::digits10;
+  const int maxDigits = std::numeric_limits<T>::max_digits10;
+  char buf[64];
+  int n = 0;
+  for (int digits = minDigits; ; ++digits) {
+    n = __printFloat__(buf, sizeof(buf), digits, (wide_type)t);
+    if (digits >= maxDigits || (T)__readFloat__(buf, wide_type()) == t)
+      break;
+  }
+  s.append(buf, n);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// showSize
+
+// Bytes needed to show a value; exact for integers and strings, an upper
+// bound for floats, and a guess for anything shown through a stream.
+template<typename T>
+inline size_t showSize(const T& t);
+
+template<typename T>
+inline size_t __showSize__(const T& t, int_to_type<SHOW_INTEGER>) {
+  return __isNegative__(t) ? __digits__(0 - (uint64_t)t) + 1 : __digits__((uint64_t)t);
+}
+template<typename T>
+inline size_t __showSize__(const T&, int_to_type<SHOW_CHAR>)   { return 1; }
+template<typename T>
+inline size_t __showSize__(const T&, int_to_type<SHOW_FLOAT>)  { return std::numeric_limits<T>::digits10 + 10; }
+template<typename T>
+inline size_t __showSize__(const T&, int_to_type<SHOW_STREAM>) { return 16; }
+
+inline size_t __showSize__(const string& s, int_to_type<SHOW_CONTAINER>)           { return s.size(); }
+inline size_t __showSize__(const string_ref& s, int_to_type<SHOW_CONTAINER>)       { return s.size(); }
+inline size_t __showSize__(const types<char>::list& c, int_to_type<SHOW_CONTAINER>) { return c.size(); }
+
+template<typename C>
+inline size_t __showSize__(const C& c, int_to_type<SHOW_CONTAINER>) {
+  size_t size = 4 * length(c) + 3;
+  for (let it = begin(c); it != end(c); ++it)
+    size += showSize(*it);
+  return size;
+}
+
+template<typename T>
+inline size_t showSize(const T& t) {
+  return __showSize__(t, int_to_type< show_traits<T>::value >());
+}
+
+///////////////////////////////////////////////////////////////////////////
+// showTo
+
+// Appends the shown value to s; show(t) is showTo on an empty string.
+template<typename T>
+inline void showTo(string& s, const T& t);
+
+template<typename T>
+inline void __showTo__(string& s, const T& t, int_to_type<SHOW_INTEGER>) { __showInteger__(s, t); }
+template<typename T>
+inline void __showTo__(string& s, const T& t, int_to_type<SHOW_CHAR>)    { s.push_back((char)t); }
+template<typename T>
+inline void __showTo__(string& s, const T& t, int_to_type<SHOW_FLOAT>)   { __showFloat__(s, t); }
+
+template<typename T>
+inline void __showTo__(string& s, const T& t, int_to_type<SHOW_STREAM>) {
+  std::stringstream ss;
+  ss << t;
+  s.append(ss.str());
+}
+
+inline void __showTo__(string& s, const string& t, int_to_type<SHOW_CONTAINER>) {
+  s.append(t);
+}
+inline void __showTo__(string& s, const string_ref& t, int_to_type<SHOW_CONTAINER>) {
+  s.append(t.data(), t.size());
+}
+inline void __showTo__(string& s, const types<char>::list& c, int_to_type<SHOW_CONTAINER>) {
+  s.append(extent(c));
+}
+
+template<typename C>
+inline void __showTo__(string& s, const C& c, int_to_type<SHOW_CONTAINER>) {
+  typedef value_type_of(C) T;
+  const bool is_nonstring_container = is_container<T>::value && !is_string<T>::value;
+  const char* infix  = is_nonstring_container ? ",\n" : ", ";
+  const char* suffix = is_nonstring_container ? "]\n" : "]";
+
+  let it = begin(c);
+  if (it == end(c))
+    return;
+  s.push_back('[');
+  while (true) {
+    showTo(s, *it);
+    if (++it == end(c)) break;
+    s.append(infix);
+  }
+  s.append(suffix);
+}
+
+template<typename T>
+inline void showTo(string& s, const T& t) {
+  __showTo__(s, t, int_to_type< show_traits<T>::value >());
+}
+inline void showTo(string& s, const char* t) {
+  s.append(t);
+}
+template<size_t N>
+inline void showTo(string& s, const char (&t)[N]) {
+  s.append(t);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Output
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+// output_buffer
+
+// Coalesces writes to a FILE into large blocks.  Terminals still see every
+// line as it is written; anything else is written once a block fills, on
+// flush(), and when the buffer is destroyed.  Output written straight to
+// std::cout in the meantime may appear before buffered output; call flush()
+// first when mixing the two.
+class output_buffer {
+public:
+  explicit output_buffer(FILE* file, size_t blockSize = 1 << 16)
+    : mFile(file), mBlockSize(blockSize), mLineBuffered(isTerminal(file)) {
+    mBuffer.reserve(blockSize);
+  }
+  ~output_buffer() { flush(); }
+
+  void write(const char* s, size_t n, bool endLine = false) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mBuffer.size() + n + 1 > mBlockSize)
+      writeBuffer();
+    if (n >= mBlockSize) {
+      fwrite(s, 1, n, mFile);
+    } else {
+      mBuffer.append(s, n);
+    }
+    if (endLine) {
+      mBuffer.push_back('\n');
+      if (mLineBuffered) writeBuffer();
+    }
+  }
+  void write(const string& s, bool endLine = false) {
+    write(s.data(), s.size(), endLine);
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    writeBuffer();
+    fflush(mFile);
+  }
+
+private:
+  output_buffer(const output_buffer&);
+  output_buffer& operator=(const output_buffer&);
+
+  void writeBuffer() {
+    if (!mBuffer.empty()) {
+      fwrite(mBuffer.data(), 1, mBuffer.size(), mFile);
+      mBuffer.clear();
+    }
+  }
+
+  static bool isTerminal(FILE* file) {
+#if defined(_WIN32)
+    return _isatty(_fileno(file)) != 0;
+#else
+    return isatty(fileno(file)) != 0;
+#endif
+  }
+
+  FILE*      mFile;
+  size_t     mBlockSize;
+  bool       mLineBuffered;
+  string     mBuffer;
+  std::mutex mMutex;
+};
+
+inline output_buffer& stdoutBuffer() {
+  static output_buffer buffer(stdout);
+  return buffer;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// flush
+
+inline void flush() {
+  stdoutBuffer().flush();
+}
+
+} /* namespace fp */
+
+#endif /* _FP_FORMAT_H_ */
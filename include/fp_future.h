@@ -0,0 +1,252 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_FUTURE_H_
+#define _FP_FUTURE_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_parallel.h"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Futures
+///////////////////////////////////////////////////////////////////////////
+
+// The result of a future, once there is one, and what to do with it then
+template<typename T>
+class __future_state__ {
+public:
+  __future_state__() : mDone(false) { }
+
+  void set(T t) {
+    mValue.reset(new T(std::move(t)));
+    finish();
+  }
+
+  void fail(std::exception_ptr e) {
+    mError = e;
+    finish();
+  }
+
+  // Calls k once the result is in, at once if it already is
+  void onReady(std::function<void()> k) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (!mDone.load(std::memory_order_relaxed)) {
+        mContinuations.push_back(std::move(k));
+        return;
+      }
+    }
+    k();
+  }
+
+  bool done() const { return mDone.load(std::memory_order_acquire); }
+
+  const T& get() const {
+    if (mError)
+      std::rethrow_exception(mError);
+    return *mValue;
+  }
+
+  const std::exception_ptr& error() const { return mError; }
+
+private:
+  void finish() {
+    types< std::function<void()> >::list continuations;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mDone.store(true, std::memory_order_release);
+      continuations.swap(mContinuations);
+    }
+    for (size_t i = 0; i < continuations.size(); ++i)
+      continuations[i]();
+  }
+
+  std::atomic<bool>                              mDone;
+  std::unique_ptr<T>                             mValue;
+  std::exception_ptr                             mError;
+  std::mutex                                     mMutex;
+  types< std::function<void()> >::list           mContinuations;
+};
+
+// Stores f()'s result or exception in s
+template<typename T, typename F>
+inline void __settle__(__future_state__<T>& s, F& f) {
+  try {
+    s.set(f());
+  } catch (...) {
+    s.fail(std::current_exception());
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// future
+
+// A value being computed on the shared pool.  map, then, zipWith and
+// sequence chain more work onto it without waiting: each continuation is
+// queued on the pool when the values it needs are in, so hundreds of small
+// computations cost a queued task each rather than a thread.  get waits
+// for the value and throws what the computation threw; called from a
+// task it blocks rather than running other queued tasks, which might be
+// waiting on it.  Copies share the result.
+// Example: let total = fp::map( sum, fp::sequence( fp::map( []( Request r ) { return fp::async( ... ); }, requests ) ) );
+template<typename T>
+class future {
+public:
+  typedef T value_type;
+
+  explicit future(std::shared_ptr< __future_state__<T> > s) : mState(std::move(s)) { }
+
+  bool ready() const { return mState->done(); }
+
+  const T& get() const {
+    const __future_state__<T>& s = *mState;
+    if (!s.done())
+      sharedPool().waitUntil([&s]() { return s.done(); });
+    return s.get();
+  }
+
+  const std::shared_ptr< __future_state__<T> >& state() const { return mState; }
+
+private:
+  std::shared_ptr< __future_state__<T> > mState;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// async
+
+// f() computed on the shared pool
+template<typename F>
+inline auto async(F f) -> future< nonconstref_type_of(decltype(f())) > {
+  typedef nonconstref_type_of(decltype(f())) T;
+  let s = std::make_shared< __future_state__<T> >();
+  sharedPool().submit([=]() mutable { __settle__(*s, f); });
+  return future<T>(s);
+}
+
+// A future that already has its value
+template<typename T>
+inline future<T> ready(T t) {
+  let s = std::make_shared< __future_state__<T> >();
+  s->set(std::move(t));
+  return future<T>(s);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// map
+
+template<typename F, typename T>
+inline auto map(F f, future<T> t) -> future< nonconstref_type_of(decltype(f(std::declval<T>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>()))) U;
+  let in  = t.state();
+  let out = std::make_shared< __future_state__<U> >();
+  in->onReady([=]() {
+    if (in->error())
+      return out->fail(in->error());
+    sharedPool().submit([=]() mutable {
+      let g = [&]() { return f(in->get()); };
+      __settle__(*out, g);
+    });
+  });
+  return future<U>(out);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// then
+
+// Chains f, which starts more asynchronous work, onto t: the result is
+// the future f returns, without a thread waiting for it
+template<typename F, typename T>
+inline auto then(F f, future<T> t) -> future< typename decltype(f(std::declval<T>()))::value_type > {
+  typedef typename decltype(f(std::declval<T>()))::value_type U;
+  let in  = t.state();
+  let out = std::make_shared< __future_state__<U> >();
+  in->onReady([=]() {
+    if (in->error())
+      return out->fail(in->error());
+    sharedPool().submit([=]() mutable {
+      try {
+        let next = f(in->get()).state();
+        next->onReady([=]() {
+          if (next->error()) out->fail(next->error());
+          else               out->set(next->get());
+        });
+      } catch (...) {
+        out->fail(std::current_exception());
+      }
+    });
+  });
+  return future<U>(out);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// zipWith
+
+template<typename F, typename T, typename U>
+inline auto zipWith(F f, future<T> t, future<U> u)
+  -> future< nonconstref_type_of(decltype(f(std::declval<T>(), std::declval<U>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>(), std::declval<U>()))) V;
+  let a   = t.state();
+  let b   = u.state();
+  let out = std::make_shared< __future_state__<V> >();
+  a->onReady([=]() {
+    b->onReady([=]() {
+      if (a->error()) return out->fail(a->error());
+      if (b->error()) return out->fail(b->error());
+      sharedPool().submit([=]() mutable {
+        let g = [&]() { return f(a->get(), b->get()); };
+        __settle__(*out, g);
+      });
+    });
+  });
+  return future<V>(out);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// sequence
+
+// The values of a list of futures, in order, once all are in; the first
+// failure in the list if any fails
+template<typename C>
+inline future< typename types<typename C::value_type::value_type>::list > sequence(const C& fs) {
+  typedef typename C::value_type::value_type  T;
+  typedef typename types<T>::list              list_type;
+  let out = std::make_shared< __future_state__<list_type> >();
+  if (fs.empty()) {
+    out->set(list_type());
+    return future<list_type>(out);
+  }
+  let all  = std::make_shared< typename types< future<T> >::list >(extent(fs));
+  let left = std::make_shared< std::atomic<size_t> >(all->size());
+  for (size_t i = 0; i < all->size(); ++i) {
+    (*all)[i].state()->onReady([=]() {
+      if (left->fetch_sub(1) != 1)
+        return;
+      list_type values;
+      values.reserve(all->size());
+      for (size_t j = 0; j < all->size(); ++j) {
+        const __future_state__<T>& s = *(*all)[j].state();
+        if (s.error())
+          return out->fail(s.error());
+        values.push_back(s.get());
+      }
+      out->set(std::move(values));
+    });
+  }
+  return future<list_type>(out);
+}
+
+} /* namespace fp */
+
+#endif /* _FP_FUTURE_H_ */
@@ -0,0 +1,213 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_GENERATOR_H_
+#define _FP_GENERATOR_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+#include "fp_stream.h"
+#include "fp_lazy.h"
+#include "fp_chunked.h"
+
+#if FP_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Generators
+///////////////////////////////////////////////////////////////////////////
+
+// A lazy source written as a coroutine: each co_yield hands out the next
+// value, and returning ends it.  A generator owns its frame and is moved,
+// not copied.  The terminals below (index, takeWhileT, foldl, list) run it
+// in place, which lets the compiler put a frame that does not outlive them
+// on the stack; map, filter, take and takeWhile turn it into a stream,
+// and lazyList and chunked take it as they take a stream.
+// Example: fp::generator<size_t> fibs() { size_t a = 0, b = 1; for (;;) { co_yield a; b += std::exchange(a, b); } }
+//          fp::takeWhileT( []( size_t x ) { return x < 4000000; }, fibs() )
+template<typename T>
+class generator {
+public:
+  typedef T value_type;
+
+  struct promise_type {
+    promise_type() : mValue(nullptr) { }
+
+    generator get_return_object() {
+      return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    std::suspend_always final_suspend()   noexcept { return std::suspend_always(); }
+
+    // The value stays in the frame until the generator resumes
+    std::suspend_always yield_value(const T& t) noexcept {
+      mValue = std::addressof(t);
+      return std::suspend_always();
+    }
+
+    void return_void() { }
+    void unhandled_exception() { mError = std::current_exception(); }
+
+    template<typename U>
+    std::suspend_never await_transform(U&&) = delete;
+
+    const T*           mValue;
+    std::exception_ptr mError;
+  };
+
+  generator(generator&& o) noexcept : mHandle(std::exchange(o.mHandle, nullptr)) { }
+  generator& operator=(generator&& o) noexcept {
+    if (this != &o) {
+      reset();
+      mHandle = std::exchange(o.mHandle, nullptr);
+    }
+    return *this;
+  }
+  ~generator() { reset(); }
+
+  // Runs to the next value; false once the coroutine has returned.  An
+  // exception thrown by the coroutine is thrown from here.
+  bool next() {
+    if (!mHandle || mHandle.done())
+      return false;
+    mHandle.resume();
+    if (!mHandle.done())
+      return true;
+    // A coroutine that threw has ended too
+    if (mHandle.promise().mError)
+      std::rethrow_exception(std::exchange(mHandle.promise().mError, nullptr));
+    return false;
+  }
+
+  // The value next() stopped at
+  const T& value() const { return *mHandle.promise().mValue; }
+
+  Maybe<T> operator()() { return next() ? Maybe<T>(value()) : Maybe<T>(); }
+
+private:
+  generator(const generator&);
+  generator& operator=(const generator&);
+
+  explicit generator(std::coroutine_handle<promise_type> h) : mHandle(h) { }
+
+  void reset() {
+    if (mHandle)
+      mHandle.destroy();
+    mHandle = nullptr;
+  }
+
+  std::coroutine_handle<promise_type> mHandle;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// toStream
+
+// The generator as a stream, for the stream combinators
+template<typename T>
+inline stream<T> toStream(generator<T> g) {
+  let shared = std::make_shared< generator<T> >(std::move(g));
+  return stream<T>([=]() { return (*shared)(); });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// index
+
+template<typename Index, typename T>
+inline T index(Index i, generator<T> g) {
+  for (Index j = 0; j <= i; ++j) {
+    if (!g.next())
+      throw std::out_of_range("generator");
+  }
+  return g.value();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// takeWhileT
+
+template<typename F, typename T>
+inline typename types<T>::list takeWhileT(F f, generator<T> g) {
+  typename types<T>::list result;
+  while (g.next() && f(g.value()))
+    result.push_back(g.value());
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// foldl
+
+template<typename F, typename T, typename U>
+inline T foldl(F f, T t, generator<U> g) {
+  while (g.next())
+    t = f(t, g.value());
+  return t;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// list
+
+template<typename T>
+inline typename types<T>::list list(generator<T> g) {
+  typename types<T>::list result;
+  while (g.next())
+    result.push_back(g.value());
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// map / filter / take / takeWhile
+
+template<typename F, typename T>
+inline auto map(F f, generator<T> g) -> decltype(map(f, toStream(std::move(g)))) {
+  return map(f, toStream(std::move(g)));
+}
+
+template<typename F, typename T>
+inline stream<T> filter(F f, generator<T> g) {
+  return filter(f, toStream(std::move(g)));
+}
+
+template<typename T>
+inline stream<T> take(size_t n, generator<T> g) {
+  return take(n, toStream(std::move(g)));
+}
+
+template<typename F, typename T>
+inline stream<T> takeWhile(F f, generator<T> g) {
+  return takeWhile(f, toStream(std::move(g)));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// lazyList / chunked
+
+template<typename T>
+inline lazy_list<T> lazyList(generator<T> g) {
+  return lazyList(toStream(std::move(g)));
+}
+
+template<typename T>
+inline chunked_stream<T> chunked(generator<T> g, size_t n = FP_CHUNK_SIZE) {
+  let shared = std::make_shared< generator<T> >(std::move(g));
+  return chunked_stream<T>([=](typename types<T>::list& b) {
+    while (b.size() < n && shared->next())
+      b.push_back(shared->value());
+    return !b.empty();
+  });
+}
+
+} /* namespace fp */
+
+#endif /* FP_COROUTINES */
+
+#endif /* _FP_GENERATOR_H_ */
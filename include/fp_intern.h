@@ -0,0 +1,404 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_INTERN_H_
+#define _FP_INTERN_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+#include "fp_parallel.h"
+#include "fp_read.h"
+#include "fp_string_list.h"
+#include "fp_string_ref.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdint.h>
+#include <thread>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Interning
+///////////////////////////////////////////////////////////////////////////
+
+typedef uint32_t symbol;
+
+inline uint64_t __hashBytes__(const string_ref& s) {
+  const uint64_t k = 0x9E3779B97F4A7C15ULL;
+  const char* p = s.data();
+  size_t n = s.size();
+  uint64_t h = n * k;
+  for (; n >= 8; n -= 8, p += 8)
+    h = (h ^ __load8__(p)) * k;
+  uint64_t tail = 0;
+  memcpy(&tail, p, n);
+  h = (h ^ tail) * k;
+  return h ^ (h >> 29);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// symbol_table
+
+// Maps strings to dense symbols 0, 1, 2, ... in the order they are first
+// interned.  intern, find and operator[] may be called from any number of
+// threads at once: lookups take no lock, and a new string claims its slot
+// with a compare-and-swap.  Only growing the table takes a lock, after the
+// old table is sealed against inserts; old tables are kept until the
+// symbol_table goes, so a lookup that raced the growth stays valid.
+class symbol_table {
+public:
+  explicit symbol_table(size_t capacity = 1024) : mCount(0) {
+    size_t slots = 64;
+    while (slots < 2 * capacity) slots *= 2;
+    mTables.push_back(std::unique_ptr<table>(new table(slots)));
+    mTable = mTables.back().get();
+    for (size_t i = 0; i < Segments; ++i)
+      mSegments[i] = nullptr;
+  }
+
+  ~symbol_table() {
+    const size_t n = size();
+    for (size_t i = 0; i < n; ++i)
+      delete entryAt((symbol)i);
+    for (size_t i = 0; i < Segments; ++i)
+      delete[] mSegments[i].load();
+  }
+
+  symbol intern(const string_ref& s) {
+    const uint64_t h = __hashBytes__(s);
+    std::unique_ptr<entry> fresh;
+    for (;;) {
+      table* t = mTable.load(std::memory_order_acquire);
+      if (entry* e = t->find(s, h))
+        return e->symbolOf();
+
+      t->writers.fetch_add(1);
+      if (t->sealed.load() || 2 * (t->used.load() + 1) > t->mask + 1) {
+        t->writers.fetch_sub(1);
+        grow(t);
+        continue;
+      }
+      if (!fresh)
+        fresh.reset(new entry(s, h));
+      entry* winner = t->insert(fresh.get());
+      if (winner == fresh.get()) {
+        t->used.fetch_add(1);
+        const symbol id = mCount.fetch_add(1);
+        publish(id, fresh.get());
+        fresh->id.store(id, std::memory_order_release);
+        fresh.release();
+        t->writers.fetch_sub(1);
+        return id;
+      }
+      t->writers.fetch_sub(1);
+      if (winner)
+        return winner->symbolOf();
+      // The table filled up under us
+      grow(t);
+    }
+  }
+
+  Maybe<symbol> find(const string_ref& s) const {
+    const entry* e = mTable.load(std::memory_order_acquire)->find(s, __hashBytes__(s));
+    return e ? Maybe<symbol>(e->symbolOf()) : Maybe<symbol>();
+  }
+
+  string_ref operator[](symbol id) const { return string_ref(entryAt(id)->text); }
+
+  size_t size() const { return mCount.load(); }
+
+private:
+  symbol_table(const symbol_table&);
+  symbol_table& operator=(const symbol_table&);
+
+  static const symbol NoSymbol = ~(symbol)0;
+  static const size_t Segments = 26;
+
+  struct entry {
+    entry(const string_ref& s, uint64_t h) : hash(h), id(NoSymbol), text(s.str()) { }
+
+    // The symbol, once the inserting thread has numbered it
+    symbol symbolOf() const {
+      symbol s;
+      while ((s = id.load(std::memory_order_acquire)) == NoSymbol)
+        std::this_thread::yield();
+      return s;
+    }
+
+    uint64_t            hash;
+    std::atomic<symbol> id;
+    string              text;
+  };
+
+  // Open addressing with linear probing; slots only go from empty to full
+  struct table {
+    explicit table(size_t slots)
+      : mask(slots - 1), entries(new std::atomic<entry*>[slots]), used(0), writers(0), sealed(false) {
+      for (size_t i = 0; i < slots; ++i)
+        entries[i] = nullptr;
+    }
+
+    entry* find(const string_ref& s, uint64_t h) const {
+      for (size_t i = h & mask, probes = 0; probes <= mask; i = (i + 1) & mask, ++probes) {
+        entry* e = entries[i].load(std::memory_order_acquire);
+        if (!e)
+          return nullptr;
+        if (e->hash == h && string_ref(e->text) == s)
+          return e;
+      }
+      return nullptr;
+    }
+
+    // e, if it took a slot; an equal entry that got there first; or null
+    // if the table is full
+    entry* insert(entry* e) {
+      for (size_t i = e->hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, ++probes) {
+        entry* expected = nullptr;
+        if (entries[i].compare_exchange_strong(expected, e, std::memory_order_acq_rel))
+          return e;
+        if (expected->hash == e->hash && expected->text == e->text)
+          return expected;
+      }
+      return nullptr;
+    }
+
+    size_t                                 mask;
+    std::unique_ptr<std::atomic<entry*>[]> entries;
+    std::atomic<size_t>                    used;
+    std::atomic<size_t>                    writers;
+    std::atomic<bool>                      sealed;
+  };
+
+  // Seals t, waits out its writers and moves every entry to a table twice
+  // the size
+  void grow(table* t) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mTable.load() != t)
+      return;
+    t->sealed.store(true);
+    while (t->writers.load() != 0)
+      std::this_thread::yield();
+
+    std::unique_ptr<table> bigger(new table(2 * (t->mask + 1)));
+    for (size_t i = 0; i <= t->mask; ++i) {
+      if (entry* e = t->entries[i].load()) {
+        bigger->insert(e);
+        bigger->used.fetch_add(1);
+      }
+    }
+    mTables.push_back(std::move(bigger));
+    mTable.store(mTables.back().get(), std::memory_order_release);
+  }
+
+  // Symbol i lives in segment k, which holds 64 << k entries
+  static size_t segmentOf(symbol i, size_t& offset) {
+    const uint64_t j = (uint64_t)i / 64 + 1;
+    size_t k = 0;
+    while ((j >> (k + 1)) != 0) ++k;
+    offset = (size_t)(i - 64 * ((1ULL << k) - 1));
+    return k;
+  }
+
+  void publish(symbol id, entry* e) {
+    size_t offset;
+    const size_t k = segmentOf(id, offset);
+    entry** segment = mSegments[k].load(std::memory_order_acquire);
+    if (!segment) {
+      entry** fresh = new entry*[(size_t)64 << k]();
+      if (mSegments[k].compare_exchange_strong(segment, fresh, std::memory_order_acq_rel))
+        segment = fresh;
+      else
+        delete[] fresh;
+    }
+    segment[offset] = e;
+  }
+
+  entry* entryAt(symbol id) const {
+    size_t offset;
+    const size_t k = segmentOf(id, offset);
+    return mSegments[k].load(std::memory_order_acquire)[offset];
+  }
+
+  std::atomic<table*>                   mTable;
+  std::atomic<symbol>                   mCount;
+  std::atomic<entry**>                  mSegments[Segments];
+  types< std::unique_ptr<table> >::list mTables;
+  std::mutex                            mMutex;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// symbol_list
+
+// A dictionary-encoded list of strings: one symbol per element, with the
+// strings in a symbol_table that any number of lists can share.  Elements
+// read as std::string values like string_list; sort, group, equality,
+// elem and frequencies work on the symbols alone.
+class symbol_list {
+public:
+  typedef string                                 value_type;
+  typedef string                                 reference;
+  typedef string                                 const_reference;
+  typedef size_t                                 size_type;
+  typedef ptrdiff_t                              difference_type;
+  typedef __string_iterator__<symbol_list>       const_iterator;
+  typedef const_iterator                         iterator;
+  typedef std::reverse_iterator<const_iterator>  const_reverse_iterator;
+  typedef const_reverse_iterator                 reverse_iterator;
+
+  explicit symbol_list(std::shared_ptr<symbol_table> table = std::make_shared<symbol_table>())
+    : mTable(std::move(table)) { }
+
+  size_t size()  const { return mSymbols.size(); }
+  bool   empty() const { return mSymbols.empty(); }
+  void   reserve(size_t n) { mSymbols.reserve(n); }
+  void   clear() { mSymbols.clear(); }
+
+  string_ref operator[](size_t i) const { return (*mTable)[mSymbols[i]]; }
+
+  string front() const { return (*this)[0].str(); }
+  string back()  const { return (*this)[size() - 1].str(); }
+
+  void push_back(const string_ref& s) { mSymbols.push_back(mTable->intern(s)); }
+  void pop_back()                     { mSymbols.pop_back(); }
+
+  iterator insert(const_iterator pos, const string_ref& s) {
+    mSymbols.insert(mSymbols.begin() + pos.index(), mTable->intern(s));
+    return pos;
+  }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end()   const { return const_iterator(this, size()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend()   const { return const_reverse_iterator(begin()); }
+
+  const types<symbol>::list&           symbols() const { return mSymbols; }
+  types<symbol>::list&                 symbols()       { return mSymbols; }
+  const std::shared_ptr<symbol_table>& table()   const { return mTable; }
+
+  operator types<string>::list() const {
+    return types<string>::list(begin(), end());
+  }
+
+private:
+  std::shared_ptr<symbol_table> mTable;
+  types<symbol>::list           mSymbols;
+};
+
+inline bool operator==(const symbol_list& a, const symbol_list& b) {
+  if (a.table() == b.table())
+    return a.symbols() == b.symbols();
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i] != b[i])
+      return false;
+  }
+  return true;
+}
+inline bool operator!=(const symbol_list& a, const symbol_list& b) { return !(a == b); }
+
+///////////////////////////////////////////////////////////////////////////
+// encode
+
+// Interns every string of c, in parallel for long lists.  Pass the table
+// of an earlier list to share its symbols.
+// Example: encode( words( string_ref( text ) ) )
+template<typename C>
+inline symbol_list encode(const C& c, std::shared_ptr<symbol_table> table = std::make_shared<symbol_table>()) {
+  symbol_list result(std::move(table));
+  types<symbol>::list& symbols = result.symbols();
+  symbols.resize(c.size());
+  symbol_table& t = *result.table();
+  parallelFor(c.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i)
+      symbols[i] = t.intern(string_ref(c[i]));
+  }, FP_PARALLEL_GRAIN * 16);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// sort
+
+// Orders the symbols of the table once, then lays out each symbol's count
+inline symbol_list sort(const symbol_list& c) {
+  const symbol_table& t = *c.table();
+  types<size_t>::list counts(t.size(), 0);
+  for (size_t i = 0; i < c.size(); ++i)
+    ++counts[c.symbols()[i]];
+
+  types<symbol>::list order;
+  for (symbol s = 0; s < (symbol)counts.size(); ++s) {
+    if (counts[s] != 0)
+      order.push_back(s);
+  }
+  std::sort(extent(order), [&](symbol a, symbol b) { return t[a] < t[b]; });
+
+  symbol_list result(c.table());
+  result.reserve(c.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    result.symbols().insert(result.symbols().end(), counts[order[i]], order[i]);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// group
+
+inline types<symbol_list>::list group(const symbol_list& c) {
+  types<symbol_list>::list result;
+  const types<symbol>::list& symbols = c.symbols();
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    if (i == 0 || symbols[i] != symbols[i - 1])
+      result.push_back(symbol_list(c.table()));
+    result.back().symbols().push_back(symbols[i]);
+  }
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// reverse
+
+inline symbol_list reverse(symbol_list c) {
+  std::reverse(extent(c.symbols()));
+  return c;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// elem
+
+template <typename T>
+inline bool elem(const T& t, const symbol_list& c) {
+  let s = c.table()->find(string_ref(t));
+  return s && std::find(extent(c.symbols()), *s) != end(c.symbols());
+}
+
+///////////////////////////////////////////////////////////////////////////
+// frequencies
+
+// Each distinct string with the number of times it occurs, in order of
+// first occurrence; counted in an array indexed by symbol, not a hash map
+inline types< std::pair<string, size_t> >::list frequencies(const symbol_list& c) {
+  const size_t none = ~(size_t)0;
+  types<size_t>::list slot(c.table()->size(), none);
+  types< std::pair<string, size_t> >::list result;
+  for (size_t i = 0; i < c.size(); ++i) {
+    const symbol s = c.symbols()[i];
+    if (slot[s] == none) {
+      slot[s] = result.size();
+      result.push_back(std::make_pair(c[i].str(), (size_t)0));
+    }
+    ++result[slot[s]].second;
+  }
+  return result;
+}
+
+} /* namespace fp */
+
+#endif /* _FP_INTERN_H_ */
@@ -9,96 +9,248 @@
 
 #include "fp_defines.h"
 #include "fp_common.h"
+#include "fp_format.h"
+#include "fp_maybe.h"
+#include "fp_read.h"
+#include "fp_stream.h"
+#include "fp_string_ref.h"
 
-#include <string>
-#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
 
+// Native file operations; on by default for Linux, where copies stay in the
+// kernel (reflink, copy_file_range or sendfile) and moves try rename first.
+#if !defined(USE_PLATFORM_SPECIFIC_CODE)
+#if defined(FP_LINUX)
+#define USE_PLATFORM_SPECIFIC_CODE 1
+#else
 #define USE_PLATFORM_SPECIFIC_CODE 0
+#endif
+#endif
 
 #if USE_PLATFORM_SPECIFIC_CODE
 #if defined(FP_WINDOWS)
 #include <Windows.h>
 #else
+#include <errno.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <stdlib.h>
-#include <sys/sendfile.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(FP_LINUX)
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+// From <linux/fs.h>, which clashes with <sys/mount.h>
+#if !defined(FICLONE)
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
 #endif
 #endif /* USE_PLATFORM_SPECIFIC_CODE */
 
+// Directories have no standard form before C++17, so listing and creating
+// them always uses the platform's calls
+#if defined(FP_WINDOWS)
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#if FP_SSE2
+#include <emmintrin.h>
+#endif
+
+// Batches of renames and removes go through io_uring where the kernel has
+// it; the ring is driven with raw syscalls, so liburing is not needed.
+#if !defined(FP_IO_URING)
+#if USE_PLATFORM_SPECIFIC_CODE && defined(FP_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FP_IO_URING 1
+#endif
+#endif
+#endif
+#if !defined(FP_IO_URING)
+#define FP_IO_URING 0
+#endif
+
+#if FP_IO_URING
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#if !defined(IORING_FEAT_NATIVE_WORKERS)
+// Headers older than 5.11 have no RENAMEAT or UNLINKAT
+#undef  FP_IO_URING
+#define FP_IO_URING 0
+#endif
+#endif
+
+// Files smaller than this are read rather than mapped: for a few pages a
+// copy is cheaper than setting up and tearing down the mapping
+#if !defined(FP_MAP_MIN_SIZE)
+#define FP_MAP_MIN_SIZE (1 << 16)
+#endif
+
+// Threads used for a batch of file operations; they wait on the disk, so
+// there can be more of them than cores
+#if !defined(FP_IO_THREADS)
+#define FP_IO_THREADS 16
+#endif
+
 namespace fp {
 
 typedef std::string FilePath;
 
-std::ifstream& readFile( const FilePath& filePath, std::ifstream& ifs ) {
+inline std::ifstream& readFile( const FilePath& filePath, std::ifstream& ifs ) {
   ifs.open( filePath );
   return ifs;
 }
 
-bool removeFile( const FilePath& filePath ) {
+inline bool removeFile( const FilePath& filePath ) {
   return remove( fromString(filePath) ) == 0;
 }
 
-bool renameFile( const FilePath& srcPath, const std::string& dstFileName ) {
+inline bool renameFile( const FilePath& srcPath, const std::string& dstFileName ) {
   return ::rename( fromString(srcPath), fromString(dstFileName) ) == 0;
 }
 
-bool copyFile( const FilePath& srcPath, const FilePath& dstPath ) {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+// Copies the rest of in to out, cheapest method first: share the extents
+// (FICLONE), copy in the kernel (copy_file_range, then sendfile), and only
+// then through a user-space buffer.
+inline bool __copyFd__( int in, int out ) {
+#if defined(FICLONE)
+  if ( ioctl( out, FICLONE, in ) == 0 )
+    return true;
+#endif
+  const size_t chunk = 1 << 30;
+  ssize_t n = -1;
+#if defined(SYS_copy_file_range)
+  while ( (n = syscall( SYS_copy_file_range, in, nullptr, out, nullptr, chunk, 0 )) > 0 ) { }
+  if ( n == 0 )
+    return true;
+  // EXDEV, ENOSYS, EINVAL: not between these files or on this kernel
+  if ( lseek( in, 0, SEEK_CUR ) != 0 )
+    return false;
+#endif
+#if defined(FP_LINUX)
+  while ( (n = sendfile( out, in, nullptr, chunk )) > 0 ) { }
+  if ( n == 0 )
+    return true;
+  if ( lseek( in, 0, SEEK_CUR ) != 0 )
+    return false;
+#endif
+  char buffer[1 << 16];
+  while ( (n = ::read( in, buffer, sizeof(buffer) )) > 0 ) {
+    for ( ssize_t written = 0, w; written < n; written += w ) {
+      if ( (w = ::write( out, buffer + written, n - written )) < 0 )
+        return false;
+    }
+  }
+  return n == 0;
+}
+#endif
+
+inline bool copyFile( const FilePath& srcPath, const FilePath& dstPath ) {
 #if USE_PLATFORM_SPECIFIC_CODE
-#if defined(PU_WINDOWS)
+#if defined(FP_WINDOWS)
   return CopyFile( fromString(srcPath), fromString(dstPath), false ) != 0;
 #else
+  // The copy goes to a file beside dstPath that is renamed over it once
+  // complete, so a failed copy leaves an existing dstPath as it was
   bool success = false;
-  int read_fd, write_fd;
-  struct stat stat_buf;
-  off_t offset = 0;
-
-  read_fd = open( fromString(srcPath), O_RDONLY );
-  if( read_fd != -1 ) {
-    if ( fstat(read_fd, &stat_buf) == 0 ) {
-      write_fd = open( fromString(dstPath), O_WRONLY | O_CREAT, stat_buf.st_mode );
-      if ( write_fd != -1 ) {
-        success = sendfile( write_fd, read_fd, &offset, stat_buf.st_size ) != -1;
-        close( write_fd );
-      }
+  struct stat stat_buf, dst_buf;
+
+  const int read_fd = open( fromString(srcPath), O_RDONLY | O_CLOEXEC );
+  if ( read_fd != -1 ) {
+    const bool same = fstat( read_fd, &stat_buf ) != 0 ||
+      ( stat( fromString(dstPath), &dst_buf ) == 0 &&
+        dst_buf.st_dev == stat_buf.st_dev && dst_buf.st_ino == stat_buf.st_ino );
+    std::string tmpPath = dstPath + ".XXXXXX";
+    const int write_fd = same ? -1 : mkstemp( &tmpPath[0] );
+    if ( write_fd != -1 ) {
+      fcntl( write_fd, F_SETFD, FD_CLOEXEC );
+      success = fchmod( write_fd, stat_buf.st_mode & 0777 ) == 0 && __copyFd__( read_fd, write_fd );
+      success = close( write_fd ) == 0 && success;
+      success = success && ::rename( tmpPath.c_str(), fromString(dstPath) ) == 0;
+      if ( !success )
+        unlink( tmpPath.c_str() );
     }
-    close(read_fd);
+    close( read_fd );
   }
   return success;
-}
 #endif /* defined(FP_WINDOWS) */
 #else  /* USE_PLATFORM_SPECIFIC_CODE */
+  // As above, through a file beside dstPath
+#if !defined(FP_WINDOWS)
+  struct stat src_buf, dst_buf;
+  if ( stat( fromString(srcPath), &src_buf ) == 0 && stat( fromString(dstPath), &dst_buf ) == 0 &&
+       src_buf.st_dev == dst_buf.st_dev && src_buf.st_ino == dst_buf.st_ino )
+    return false;
+#endif
+  static std::atomic<unsigned> copies( 0 );
+  const FilePath tmpPath = dstPath + ".fpcopy" + std::to_string( copies++ );
+  bool success = false;
   std::ifstream ifs( srcPath, std::ios::in  | std::ios::binary );
   if ( ifs.is_open() ) {
-    std::ofstream ofs( dstPath, std::ios::out | std::ios::binary );
+    std::ofstream ofs( tmpPath, std::ios::out | std::ios::binary );
     if ( ofs.is_open() ) {
       ofs << ifs.rdbuf();
-      return !ofs.bad() /* && ifs.eof() */ ;
+      ofs.close();
+      success = !ofs.bad() /* && ifs.eof() */ ;
     }
   }
-  return false;
+  // rename does not replace an existing file everywhere
+  if ( success && ::rename( fromString(tmpPath), fromString(dstPath) ) != 0 )
+    success = removeFile( dstPath ) && ::rename( fromString(tmpPath), fromString(dstPath) ) == 0;
+  if ( !success )
+    removeFile( tmpPath );
+  return success;
 #endif
 }
 
-bool moveFile( const FilePath& srcPath, const FilePath& dstPath ) {
+inline bool moveFile( const FilePath& srcPath, const FilePath& dstPath ) {
+#if USE_PLATFORM_SPECIFIC_CODE
+#if defined(FP_WINDOWS)
+  return MoveFileEx( fromString(srcPath), fromString(dstPath),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED ) != 0;
+#else
+  // A rename is a metadata update; only a move across devices copies
+  if ( renameFile( srcPath, dstPath ) )
+    return true;
+  if ( errno != EXDEV )
+    return false;
+#endif /* defined(FP_WINDOWS) */
+#endif /* USE_PLATFORM_SPECIFIC_CODE */
   return copyFile( srcPath, dstPath ) && removeFile( srcPath );
 }
 
-bool doesFileExist( const FilePath& filePath ) {
+inline bool doesFileExist( const FilePath& filePath ) {
 #if USE_PLATFORM_SPECIFIC_CODE
 #if defined(FP_WINDOWS)
-  DWORD attributes = GetFileAttributes( fromString(filePath) );
-  if (attributes != INVALID_FILE_ATTRIBUTES &&
-      attributes & FILE_ATTRIBUTE_DIRECTORY)
-    return true;
-  else
-    return false;
+  return GetFileAttributes( fromString(filePath) ) != INVALID_FILE_ATTRIBUTES;
 #else
   struct stat sb;
-  return (stat( fromString(filePath), &sb ) == 0) && S_ISDIR(sb.st_mode);
+  return stat( fromString(filePath), &sb ) == 0;
 #endif /* defined(FP_WINDOWS) */
 #else /* USE_PLATFORM_SPECIFIC_CODE */
   std::ifstream ifs( filePath );
@@ -106,7 +258,19 @@ bool doesFileExist( const FilePath& filePath ) {
 #endif
 }
 
-size_t fileSize( const FilePath& filePath ) {
+inline bool createDirectory( const FilePath& dirPath ) {
+#if defined(FP_WINDOWS)
+  return CreateDirectoryA( fromString(dirPath), nullptr ) != 0;
+#else
+  return mkdir( fromString(dirPath), 0777 ) == 0;
+#endif
+}
+
+inline size_t fileSize( const FilePath& filePath ) {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+  struct stat sb;
+  return stat( fromString(filePath), &sb ) == 0 ? (size_t)sb.st_size : 0;
+#else
   std::streampos fsize = 0;
   std::ifstream file(filePath, std::ios::binary);
   if (file.is_open()) {
@@ -115,6 +279,1216 @@ size_t fileSize( const FilePath& filePath ) {
     fsize = file.tellg() - fsize;
   }
   return (size_t)fsize;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Mapped files
+///////////////////////////////////////////////////////////////////////////
+
+// The contents of a whole file, mapped into memory where the platform
+// allows and read into a buffer otherwise.  The bytes are followed by a
+// '\0', so they can be handed to parsers that want a C string.  A writable
+// mapping is private: writes (e.g. by an in-situ parser) copy the touched
+// pages and never reach the file.
+class mapped_file {
+public:
+  mapped_file() : mData(nullptr), mSize(0), mMapped(0) { }
+
+  explicit mapped_file( const FilePath& filePath, bool writable = false )
+    : mData(nullptr), mSize(0), mMapped(0) {
+    open( filePath, writable );
+  }
+
+  mapped_file( mapped_file&& o )
+    : mData(o.mData), mSize(o.mSize), mMapped(o.mMapped), mBuffer(std::move(o.mBuffer)) {
+    o.mData = nullptr; o.mSize = 0; o.mMapped = 0;
+  }
+
+  mapped_file& operator=( mapped_file&& o ) {
+    if ( this != &o ) {
+      close();
+      std::swap( mData, o.mData );
+      std::swap( mSize, o.mSize );
+      std::swap( mMapped, o.mMapped );
+      mBuffer.swap( o.mBuffer );
+    }
+    return *this;
+  }
+
+  ~mapped_file() { close(); }
+
+  bool        valid() const { return mData != nullptr; }
+  const char* data()  const { return mData; }
+  char*       data()        { return mData; }
+  size_t      size()  const { return mSize; }
+  string_ref  text()  const { return string_ref( mData, mSize ); }
+
+private:
+  mapped_file( const mapped_file& );
+  mapped_file& operator=( const mapped_file& );
+
+  void open( const FilePath& filePath, bool writable ) {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+    const int fd = ::open( fromString(filePath), O_RDONLY | O_CLOEXEC );
+    if ( fd == -1 )
+      return;
+    struct stat sb;
+    if ( fstat( fd, &sb ) == 0 && S_ISREG(sb.st_mode) ) {
+      const size_t size = (size_t)sb.st_size;
+      if ( size < FP_MAP_MIN_SIZE || !map( fd, size, writable ) )
+        read( fd, size );
+    }
+    ::close( fd );
+#else
+    (void)writable;
+    std::ifstream ifs( filePath, std::ios::in | std::ios::binary );
+    if ( !ifs.is_open() )
+      return;
+    mBuffer.assign( std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() );
+    mSize = mBuffer.size();
+    mBuffer.push_back( '\0' );
+    mData = &mBuffer[0];
+#endif
+  }
+
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+  // Reserves at least one byte more than the file and maps the file over
+  // the front.  The rest of the file's last page reads as zeros; when the
+  // file fills its last page exactly, the terminator is the first byte of
+  // the anonymous page after it.
+  bool map( int fd, size_t size, bool writable ) {
+    const size_t page   = (size_t)sysconf( _SC_PAGESIZE );
+    const size_t length = (size / page + 1) * page;
+    const int    prot   = PROT_READ | (writable ? PROT_WRITE : 0);
+    void* base = mmap( nullptr, length, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( base == MAP_FAILED )
+      return false;
+    if ( mmap( base, size, prot, MAP_PRIVATE | MAP_FIXED, fd, 0 ) == MAP_FAILED ) {
+      munmap( base, length );
+      return false;
+    }
+    madvise( base, size, MADV_SEQUENTIAL );
+    mData   = (char*)base;
+    mSize   = size;
+    mMapped = length;
+    return true;
+  }
+
+  void read( int fd, size_t size ) {
+    mBuffer.resize( size + 1 );
+    size_t n = 0;
+    for ( ssize_t r; n < size; n += (size_t)r ) {
+      if ( (r = ::read( fd, &mBuffer[n], size - n )) <= 0 )
+        break;
+    }
+    if ( n != size ) {
+      types<char>::list().swap( mBuffer );
+      return;
+    }
+    mBuffer[size] = '\0';
+    mData = &mBuffer[0];
+    mSize = size;
+  }
+#endif
+
+  void close() {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+    if ( mMapped )
+      munmap( mData, mMapped );
+#endif
+    mData = nullptr; mSize = 0; mMapped = 0;
+    types<char>::list().swap( mBuffer );
+  }
+
+  char*              mData;
+  size_t             mSize;
+  size_t             mMapped;  // Bytes of address space mapped, or 0 when read
+  types<char>::list  mBuffer;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Writing files
+///////////////////////////////////////////////////////////////////////////
+
+struct write_options {
+  write_options( bool background_ = false, size_t blockSize_ = 1 << 20 )
+    : background(background_), blockSize(blockSize_) { }
+
+  bool   background;  // Write each full block from a second thread
+  size_t blockSize;   // Bytes coalesced into each write
+};
+
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+typedef int   __file_handle__;
+#else
+typedef FILE* __file_handle__;
+#endif
+
+// Writes all of parts in order, gathering up to 64 of them per writev
+inline bool __writeParts__( __file_handle__ h, const string_ref* parts, size_t n ) {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+  struct iovec iov[64];
+  while ( n > 0 ) {
+    const size_t count = std::min<size_t>( n, 64 );
+    for ( size_t i = 0; i < count; ++i ) {
+      iov[i].iov_base = (void*)parts[i].data();
+      iov[i].iov_len  = parts[i].size();
+    }
+    struct iovec* v = iov;
+    int left = (int)count;
+    while ( left > 0 ) {
+      ssize_t w = writev( h, v, left );
+      if ( w < 0 ) {
+        if ( errno == EINTR )
+          continue;
+        return false;
+      }
+      for ( ; left > 0 && (size_t)w >= v->iov_len; ++v, --left )
+        w -= v->iov_len;
+      if ( left > 0 ) {
+        v->iov_base = (char*)v->iov_base + w;
+        v->iov_len -= w;
+      }
+    }
+    parts += count;
+    n     -= count;
+  }
+  return true;
+#else
+  for ( size_t i = 0; i < n; ++i ) {
+    if ( fwrite( parts[i].data(), 1, parts[i].size(), h ) != parts[i].size() )
+      return false;
+  }
+  return true;
+#endif
+}
+
+// Writes to a file in blocks of write_options::blockSize.  In the
+// background, one block is written while the next fills; otherwise a piece
+// too long to be worth copying goes out with the block in one writev.
+// Example: line_writer out( "log.txt" ); out.writeLine( "a" ); out.close();
+class line_writer {
+public:
+  explicit line_writer( const FilePath& filePath, const write_options& options = write_options() )
+    : mOptions(options), mOwned(true), mOk(false), mDone(false) {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+    mHandle = ::open( fromString(filePath), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+    mOk = mHandle != -1;
+#else
+    mHandle = fopen( fromString(filePath), "wb" );
+    mOk = mHandle != nullptr;
+#endif
+    start();
+  }
+
+  // Writes to an open file, e.g. stdout, which is left open
+  explicit line_writer( FILE* file, const write_options& options = write_options() )
+    : mOptions(options), mOwned(false), mOk(true), mDone(false) {
+    fflush( file );
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+    mHandle = fileno( file );
+#else
+    mHandle = file;
+#endif
+    start();
+  }
+
+  ~line_writer() { close(); }
+
+  void write( const string_ref& s ) {
+    if ( mBlock.size() + s.size() > mOptions.blockSize ) {
+      if ( !mOptions.background && s.size() >= mOptions.blockSize / 2 ) {
+        const string_ref parts[] = { string_ref( mBlock ), s };
+        mOk = mOk && __writeParts__( mHandle, parts, 2 );
+        mBlock.clear();
+        return;
+      }
+      submit();
+    }
+    mBlock.append( s.data(), s.size() );
+  }
+
+  void writeLine( const string_ref& line ) {
+    if ( mBlock.size() + line.size() + 1 > mOptions.blockSize ) {
+      write( line );
+      write( string_ref( "\n", 1 ) );
+    } else {
+      mBlock.append( line.data(), line.size() );
+      mBlock.push_back( '\n' );
+    }
+  }
+
+  // Writes what is left and closes the file; false if any write failed
+  bool close() {
+    if ( mDone )
+      return mOk;
+    submit();
+    if ( mWriter.joinable() ) {
+      {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mDone = true;
+      }
+      mReady.notify_one();
+      mWriter.join();
+    }
+    mDone = true;
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+    if ( mOwned && mHandle != -1 )
+      mOk = ::close( mHandle ) == 0 && mOk;
+#else
+    if ( mHandle )
+      mOk = ( mOwned ? fclose( mHandle ) : fflush( mHandle ) ) == 0 && mOk;
+#endif
+    return mOk;
+  }
+
+private:
+  line_writer( const line_writer& );
+  line_writer& operator=( const line_writer& );
+
+  void start() {
+    mBlock.reserve( mOptions.blockSize );
+    if ( mOk && mOptions.background ) {
+      mFree.push_back( string() );
+      mFree.back().reserve( mOptions.blockSize );
+      mWriter = std::thread( [this]() { run(); } );
+    }
+  }
+
+  // Hands over the current block and takes an empty one
+  void submit() {
+    if ( mBlock.empty() )
+      return;
+    if ( !mWriter.joinable() ) {
+      const string_ref part( mBlock );
+      mOk = mOk && __writeParts__( mHandle, &part, 1 );
+      mBlock.clear();
+      return;
+    }
+    std::unique_lock<std::mutex> lock( mMutex );
+    mFull.push_back( std::move(mBlock) );
+    mReady.notify_one();
+    mSpare.wait( lock, [this]() { return !mFree.empty(); } );
+    mBlock = std::move( mFree.back() );
+    mFree.pop_back();
+    mBlock.clear();
+  }
+
+  // Background writer: takes every full block, writes them together and
+  // returns them to be filled again
+  void run() {
+    std::unique_lock<std::mutex> lock( mMutex );
+    for (;;) {
+      mReady.wait( lock, [this]() { return !mFull.empty() || mDone; } );
+      if ( mFull.empty() )
+        return;
+      types<string>::list blocks;
+      blocks.swap( mFull );
+      const bool ok = mOk;
+      lock.unlock();
+      const types<string_ref>::list parts( extent(blocks) );
+      const bool written = ok && __writeParts__( mHandle, parts.data(), parts.size() );
+      lock.lock();
+      mOk = written;
+      for ( size_t i = 0; i < blocks.size(); ++i )
+        mFree.push_back( std::move(blocks[i]) );
+      mSpare.notify_one();
+    }
+  }
+
+  write_options            mOptions;
+  __file_handle__          mHandle;
+  bool                     mOwned;
+  bool                     mOk;
+  bool                     mDone;
+  string                   mBlock;
+  types<string>::list      mFull;
+  types<string>::list      mFree;
+  std::mutex               mMutex;
+  std::condition_variable  mReady;
+  std::condition_variable  mSpare;
+  std::thread              mWriter;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// writeLines
+
+// Writes each element of a list or stream of strings (or string_refs) as a
+// line, replacing the file; false if the file could not be written.
+template<typename C>
+inline bool writeLines( const FilePath& filePath, const C& lines, const write_options& options = write_options() ) {
+  line_writer writer( filePath, options );
+  for ( const let& line : lines )
+    writer.writeLine( line );
+  return writer.close();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// writeFile
+
+inline bool writeFile( const FilePath& filePath, const string_ref& contents ) {
+  line_writer writer( filePath );
+  writer.write( contents );
+  return writer.close();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// putLines
+
+// writeLines to stdout, after anything already printed
+template<typename C>
+inline bool putLines( const C& lines, const write_options& options = write_options() ) {
+  flush();
+  line_writer writer( stdout, options );
+  for ( const let& line : lines )
+    writer.writeLine( line );
+  return writer.close();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Reading streams
+///////////////////////////////////////////////////////////////////////////
+
+struct read_options {
+  read_options( bool background_ = true, size_t blockSize_ = 1 << 20 )
+    : background(background_), blockSize(blockSize_) { }
+
+  bool   background;  // Read the next blocks from a second thread
+  size_t blockSize;   // Most bytes taken by each read
+};
+
+// Appends the offset of each '\n' in [first,last) to ends
+inline void __newlines__( const char* first, const char* last, types<size_t>::list& ends ) {
+  const char* p = first;
+#if FP_SSE2
+  const __m128i nl = _mm_set1_epi8( '\n' );
+  for ( ; last - p >= 16; p += 16 ) {
+    unsigned mask = (unsigned)_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)p ), nl ) );
+    for ( ; mask; mask &= mask - 1 )
+      ends.push_back( (p - first) + __ctz64__( mask ) );
+  }
+#endif
+  for ( ; p != last; ++p ) {
+    if ( *p == '\n' )
+      ends.push_back( p - first );
+  }
+}
+
+// Blocks of a file, read ahead by a second thread with two blocks in
+// flight while the reader holds a third.  Shared with the thread, which may
+// be blocked in a read of a pipe when the reader goes away; the last of
+// the two to let go closes the file.
+class __read_ahead__ {
+public:
+  static const size_t Blocks = 3;
+
+  __read_ahead__( __file_handle__ h, bool owned, const read_options& options )
+    : mHandle(h), mOwned(owned), mBlockSize(std::max<size_t>( options.blockSize, 1 )),
+      mCancelled(false) {
+    for ( size_t i = 0; i < Blocks; ++i ) {
+      mData[i].reset( new char[mBlockSize] );
+      mSizes[i] = 0;
+      mFree.push_back( i );
+    }
+  }
+
+  ~__read_ahead__() {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+    if ( mOwned && mHandle != -1 )
+      ::close( mHandle );
+#else
+    if ( mOwned && mHandle )
+      fclose( mHandle );
+#endif
+  }
+
+  // The next block, which is empty at the end of the file
+  size_t take( bool background ) {
+    if ( !background ) {
+      const size_t i = mFree.front();
+      mFree.pop_front();
+      mSizes[i] = fill( i );
+      return i;
+    }
+    std::unique_lock<std::mutex> lock( mMutex );
+    mFilled.wait( lock, [this]() { return !mFull.empty(); } );
+    const size_t i = mFull.front();
+    mFull.pop_front();
+    return i;
+  }
+
+  void give( size_t i ) {
+    {
+      std::lock_guard<std::mutex> lock( mMutex );
+      mFree.push_back( i );
+    }
+    mEmptied.notify_one();
+  }
+
+  void cancel() {
+    {
+      std::lock_guard<std::mutex> lock( mMutex );
+      mCancelled = true;
+    }
+    mEmptied.notify_one();
+  }
+
+  static void run( std::shared_ptr<__read_ahead__> self ) {
+    std::unique_lock<std::mutex> lock( self->mMutex );
+    for (;;) {
+      self->mEmptied.wait( lock, [&]() { return !self->mFree.empty() || self->mCancelled; } );
+      if ( self->mCancelled )
+        return;
+      const size_t i = self->mFree.front();
+      self->mFree.pop_front();
+      lock.unlock();
+      const size_t n = self->fill( i );
+      lock.lock();
+      self->mSizes[i] = n;
+      self->mFull.push_back( i );
+      self->mFilled.notify_one();
+      if ( n == 0 )
+        return;
+    }
+  }
+
+  const char* data( size_t i ) const { return mData[i].get(); }
+  size_t      size( size_t i ) const { return mSizes[i]; }
+
+private:
+  // Bytes read into block i: whatever one read returns, so lines from a
+  // slow pipe are seen as they arrive; 0 at the end or on an error
+  size_t fill( size_t i ) {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+    for (;;) {
+      const ssize_t n = ::read( mHandle, mData[i].get(), mBlockSize );
+      if ( n >= 0 || errno != EINTR )
+        return n > 0 ? (size_t)n : 0;
+    }
+#else
+    return mHandle ? fread( mData[i].get(), 1, mBlockSize, mHandle ) : 0;
+#endif
+  }
+
+  __file_handle__          mHandle;
+  bool                     mOwned;
+  size_t                   mBlockSize;
+  bool                     mCancelled;
+  std::unique_ptr<char[]>  mData[Blocks];
+  size_t                   mSizes[Blocks];
+  std::deque<size_t>       mFull;
+  std::deque<size_t>       mFree;
+  std::mutex               mMutex;
+  std::condition_variable  mFilled;
+  std::condition_variable  mEmptied;
+};
+
+// Splits each block into lines at once; a line that spans blocks is
+// joined in mCarry.
+class __line_reader__ {
+public:
+  __line_reader__( __file_handle__ h, bool owned, const read_options& options )
+    : mBlocks(std::make_shared<__read_ahead__>( h, owned, options )),
+      mBackground(options.background), mBlock(0), mLine(0), mStart(0),
+      mJoined(false), mEnded(false) {
+    if ( mBackground )
+      std::thread( &__read_ahead__::run, mBlocks ).detach();
+    load();
+  }
+
+  ~__line_reader__() {
+    if ( mBackground )
+      mBlocks->cancel();
+  }
+
+  Maybe<string_ref> next() {
+    for (;;) {
+      if ( mLine < mEnds.size() ) {
+        const char*  p     = mBlocks->data( mBlock );
+        const size_t first = mStart;
+        mStart = mEnds[mLine++] + 1;
+        if ( first == 0 && !mCarry.empty() && !mJoined ) {
+          mCarry.append( p, mStart - 1 );
+          mJoined = true;
+          return just( string_ref( mCarry ) );
+        }
+        return just( string_ref( p + first, p + mStart - 1 ) );
+      }
+      if ( mEnded )
+        return Nothing();
+
+      // Keep the unfinished line and move on to the next block
+      const char* p = mBlocks->data( mBlock );
+      if ( mJoined )
+        mCarry.assign( p + mStart, p + mBlocks->size( mBlock ) );
+      else
+        mCarry.append( p + mStart, p + mBlocks->size( mBlock ) );
+      mBlocks->give( mBlock );
+      load();
+      if ( mEnded && !mCarry.empty() )
+        return just( string_ref( mCarry ) );
+    }
+  }
+
+private:
+  void load() {
+    mBlock  = mBlocks->take( mBackground );
+    mLine   = 0;
+    mStart  = 0;
+    mJoined = false;
+    mEnds.clear();
+    mEnded = mBlocks->size( mBlock ) == 0;
+    const char* p = mBlocks->data( mBlock );
+    __newlines__( p, p + mBlocks->size( mBlock ), mEnds );
+  }
+
+  std::shared_ptr<__read_ahead__> mBlocks;
+  bool                            mBackground;
+  size_t                          mBlock;
+  types<size_t>::list             mEnds;
+  size_t                          mLine;
+  size_t                          mStart;
+  string                          mCarry;
+  bool                            mJoined;
+  bool                            mEnded;
+};
+
+inline stream<string_ref> __lineStream__( __file_handle__ h, bool owned, const read_options& options ) {
+  let reader = std::make_shared<__line_reader__>( h, owned, options );
+  return stream<string_ref>( [=]() { return reader->next(); } );
+}
+
+///////////////////////////////////////////////////////////////////////////
+// readLines
+
+// The lines of a file, pipe or stdin, read a block at a time as the stream
+// is consumed.  Lines are views without their '\n', valid only until the
+// next line is read; copy any that are kept, as list below does.  Reading
+// runs ahead of the stream, so input after the last line taken is not left
+// for anyone else.
+// Example: fp::list( fp::filter( isError, fp::readLines() ) )
+inline stream<string_ref> readLines( FILE* file = stdin, const read_options& options = read_options() ) {
+  // A prompt written with putStr is still buffered
+  if ( file == stdin )
+    flush();
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+  // The reading thread can outlive the stream, so it gets its own handle
+  return __lineStream__( dup( fileno( file ) ), true, options );
+#else
+  return __lineStream__( file, false, read_options( false, options.blockSize ) );
+#endif
+}
+
+inline stream<string_ref> readLines( const FilePath& filePath, const read_options& options = read_options() ) {
+#if USE_PLATFORM_SPECIFIC_CODE && !defined(FP_WINDOWS)
+  return __lineStream__( ::open( fromString(filePath), O_RDONLY | O_CLOEXEC ), true, options );
+#else
+  return __lineStream__( fopen( fromString(filePath), "rb" ), true, options );
+#endif
+}
+
+// The lines as strings: the views a line stream hands out do not outlive
+// the block they were read into, so keeping them means copying them
+inline types<string>::list list( const stream<string_ref>& s ) {
+  types<string>::list result;
+  for ( Maybe<string_ref> t = s(); t; t = s() )
+    result.push_back( (*t).str() );
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Directories
+///////////////////////////////////////////////////////////////////////////
+
+enum file_type {
+  FILE_UNKNOWN = 0,
+  FILE_REGULAR,
+  FILE_DIRECTORY,
+  FILE_SYMLINK,
+  FILE_OTHER,
+};
+
+struct dir_entry {
+  dir_entry() : type(FILE_UNKNOWN), size(0), mtime(0) { }
+
+  FilePath  path;
+  file_type type;
+  uint64_t  size;   // Only with walk_options::stat
+  int64_t   mtime;  // Seconds since the epoch, only with walk_options::stat
+};
+
+struct walk_options {
+  walk_options( bool stat_ = false, size_t threads_ = FP_IO_THREADS )
+    : stat(stat_), threads(threads_) { }
+
+  bool   stat;     // Fill in size and mtime
+  size_t threads;  // Directories listed at once by walkDirectory
+};
+
+#if defined(FP_WINDOWS)
+// Reads the names in one directory through FindFirstFile/FindNextFile,
+// which also give each name's type, size and time
+class __dir_reader__ {
+public:
+  explicit __dir_reader__( const FilePath& dirPath ) : mFirst(true) {
+    mFind = FindFirstFileA( fromString(dirPath + "\\*"), &mData );
+  }
+  ~__dir_reader__() {
+    if ( mFind != INVALID_HANDLE_VALUE ) FindClose( mFind );
+  }
+
+  bool valid() const { return mFind != INVALID_HANDLE_VALUE; }
+
+  const WIN32_FIND_DATAA& data() const { return mData; }
+
+  // The next name other than . and ..; the type is in data()
+  bool next( const char*& name, unsigned char& type ) {
+    for (;;) {
+      if ( !mFirst && !FindNextFileA( mFind, &mData ) )
+        return false;
+      mFirst = false;
+      name = mData.cFileName;
+      type = 0;
+      if ( !(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) )
+        return true;
+    }
+  }
+
+private:
+  __dir_reader__( const __dir_reader__& );
+  __dir_reader__& operator=( const __dir_reader__& );
+
+  HANDLE           mFind;
+  WIN32_FIND_DATAA mData;
+  bool             mFirst;
+};
+
+// Fills e for the name dir has just read; the find data already has all
+// of it, so wantStat costs nothing extra
+inline void __dirEntry__( const __dir_reader__& dir, const FilePath& dirPath, const char* name,
+                          unsigned char, bool, dir_entry& e ) {
+  const WIN32_FIND_DATAA& d = dir.data();
+  e.path.reserve( dirPath.size() + strlen(name) + 1 );
+  e.path.assign( dirPath );
+  if ( e.path.empty() || (e.path[e.path.size() - 1] != '\\' && e.path[e.path.size() - 1] != '/') )
+    e.path.push_back( '\\' );
+  e.path.append( name );
+  e.type = (d.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && d.dwReserved0 == IO_REPARSE_TAG_SYMLINK
+             ? FILE_SYMLINK
+         : (d.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FILE_DIRECTORY
+         : (d.dwFileAttributes & FILE_ATTRIBUTE_DEVICE)    ? FILE_OTHER
+         : FILE_REGULAR;
+  e.size = ((uint64_t)d.nFileSizeHigh << 32) | d.nFileSizeLow;
+  // 100ns ticks since 1601
+  const uint64_t ticks = ((uint64_t)d.ftLastWriteTime.dwHighDateTime << 32) | d.ftLastWriteTime.dwLowDateTime;
+  e.mtime = (int64_t)(ticks / 10000000) - 11644473600LL;
+}
+#else
+// Reads the names in one directory; on Linux straight from getdents64 in
+// 32KB batches, elsewhere through readdir.
+class __dir_reader__ {
+public:
+  explicit __dir_reader__( const FilePath& dirPath ) : mPos(0), mSize(0) {
+#if defined(FP_LINUX) && defined(SYS_getdents64)
+    mFd = open( fromString(dirPath), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+#else
+    mDir = opendir( fromString(dirPath) );
+    mFd  = mDir ? dirfd( mDir ) : -1;
+#endif
+  }
+  ~__dir_reader__() {
+#if defined(FP_LINUX) && defined(SYS_getdents64)
+    if ( mFd >= 0 ) ::close( mFd );
+#else
+    if ( mDir ) closedir( mDir );
+#endif
+  }
+
+  bool valid() const { return mFd >= 0; }
+  int  fd()    const { return mFd; }
+
+  // The next name other than . and .., with its DT_* type
+  bool next( const char*& name, unsigned char& type ) {
+    for (;;) {
+#if defined(FP_LINUX) && defined(SYS_getdents64)
+      struct dirent64_t {
+        uint64_t       d_ino;
+        int64_t        d_off;
+        unsigned short d_reclen;
+        unsigned char  d_type;
+        char           d_name[1];
+      };
+      if ( mPos >= mSize ) {
+        const long n = mFd < 0 ? -1 : syscall( SYS_getdents64, mFd, mBuffer, sizeof(mBuffer) );
+        if ( n <= 0 )
+          return false;
+        mPos  = 0;
+        mSize = (size_t)n;
+      }
+      const dirent64_t* d = (const dirent64_t*)((const char*)mBuffer + mPos);
+      mPos += d->d_reclen;
+#else
+      const struct dirent* d = mDir ? readdir( mDir ) : nullptr;
+      if ( !d )
+        return false;
+#endif
+      name = d->d_name;
+      type = d->d_type;
+      if ( !(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) )
+        return true;
+    }
+  }
+
+private:
+  __dir_reader__( const __dir_reader__& );
+  __dir_reader__& operator=( const __dir_reader__& );
+
+  int      mFd;
+#if !(defined(FP_LINUX) && defined(SYS_getdents64))
+  DIR*     mDir;
+#endif
+  size_t   mPos, mSize;
+  uint64_t mBuffer[4096];
+};
+
+inline file_type __fileType__( unsigned char type ) {
+  switch ( type ) {
+    case DT_REG: return FILE_REGULAR;
+    case DT_DIR: return FILE_DIRECTORY;
+    case DT_LNK: return FILE_SYMLINK;
+    case DT_UNKNOWN: return FILE_UNKNOWN;
+    default:     return FILE_OTHER;
+  }
+}
+
+// Fills e for name in the open directory dirPath.  Metadata comes from
+// statx relative to the directory when asked for, or when the file system
+// did not report the type.
+inline void __dirEntry__( const __dir_reader__& dir, const FilePath& dirPath, const char* name,
+                          unsigned char type, bool wantStat, dir_entry& e ) {
+  e.path.reserve( dirPath.size() + strlen(name) + 1 );
+  e.path.assign( dirPath );
+  if ( e.path.empty() || e.path[e.path.size() - 1] != '/' )
+    e.path.push_back( '/' );
+  e.path.append( name );
+  e.type = __fileType__( type );
+  if ( !wantStat && e.type != FILE_UNKNOWN )
+    return;
+
+#if defined(STATX_SIZE)
+  struct statx stx;
+  if ( statx( dir.fd(), name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+              STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx ) != 0 )
+    return;
+  const mode_t mode = stx.stx_mode;
+  e.size  = stx.stx_size;
+  e.mtime = stx.stx_mtime.tv_sec;
+#else
+  struct stat st;
+  if ( fstatat( dir.fd(), name, &st, AT_SYMLINK_NOFOLLOW ) != 0 )
+    return;
+  const mode_t mode = st.st_mode;
+  e.size  = (uint64_t)st.st_size;
+  e.mtime = (int64_t)st.st_mtime;
+#endif
+  e.type = S_ISREG(mode) ? FILE_REGULAR   :
+           S_ISDIR(mode) ? FILE_DIRECTORY :
+           S_ISLNK(mode) ? FILE_SYMLINK   : FILE_OTHER;
+}
+#endif /* defined(FP_WINDOWS) */
+
+// Shared state of walkDirectory: workers take directories off mDirs, list
+// them, and hand entries to the consumer in batches through a bounded
+// queue, so a slow consumer holds back the walk instead of buffering it.
+class __dir_walk__ {
+public:
+  __dir_walk__( const FilePath& root, const walk_options& options )
+    : mOptions(options), mPending(1), mCancel(false), mOutPos(0) {
+    mDirs.push_back( root );
+    const size_t threads = std::max<size_t>( options.threads, 1 );
+    for ( size_t i = 0; i < threads; ++i )
+      mThreads.push_back( std::thread( [this]() { work(); } ) );
+  }
+
+  ~__dir_walk__() {
+    {
+      std::lock_guard<std::mutex> lock( mMutex );
+      mCancel = true;
+    }
+    mWork.notify_all();
+    mSpace.notify_all();
+    std::for_each( extent(mThreads), [](std::thread& t) { t.join(); } );
+  }
+
+  Maybe<dir_entry> next() {
+    if ( mOutPos == mOut.size() ) {
+      mOut.clear();
+      mOutPos = 0;
+      std::unique_lock<std::mutex> lock( mMutex );
+      mData.wait( lock, [this]() { return !mReady.empty() || mPending == 0; } );
+      if ( mReady.empty() )
+        return Nothing();
+      mOut.swap( mReady );
+      mSpace.notify_all();
+    }
+    return Maybe<dir_entry>( std::move( mOut[mOutPos++] ) );
+  }
+
+private:
+  __dir_walk__( const __dir_walk__& );
+  __dir_walk__& operator=( const __dir_walk__& );
+
+  enum { BATCH = 256, LIMIT = 16 * BATCH };
+
+  void work() {
+    types<dir_entry>::list batch;
+    types<FilePath>::list  subdirs;
+    for (;;) {
+      FilePath dirPath;
+      {
+        std::unique_lock<std::mutex> lock( mMutex );
+        mWork.wait( lock, [this]() { return mCancel || !mDirs.empty() || mPending == 0; } );
+        if ( mCancel || mDirs.empty() )
+          return;
+        dirPath = std::move( mDirs.back() );
+        mDirs.pop_back();
+      }
+
+      __dir_reader__ dir( dirPath );
+      const char* name;
+      unsigned char type;
+      while ( dir.valid() && dir.next( name, type ) ) {
+        batch.push_back( dir_entry() );
+        __dirEntry__( dir, dirPath, name, type, mOptions.stat, batch.back() );
+        if ( batch.back().type == FILE_DIRECTORY )
+          subdirs.push_back( batch.back().path );
+        if ( batch.size() == BATCH && !publish( batch ) )
+          return;
+      }
+      if ( !publish( batch ) )
+        return;
+
+      std::lock_guard<std::mutex> lock( mMutex );
+      mPending += subdirs.size();
+      std::move( extent(subdirs), back(mDirs) );
+      subdirs.clear();
+      if ( --mPending == 0 ) {
+        mWork.notify_all();
+        mData.notify_all();
+      } else {
+        mWork.notify_all();
+      }
+    }
+  }
+
+  bool publish( types<dir_entry>::list& batch ) {
+    if ( batch.empty() )
+      return true;
+    std::unique_lock<std::mutex> lock( mMutex );
+    mSpace.wait( lock, [this]() { return mCancel || mReady.size() < LIMIT; } );
+    if ( mCancel )
+      return false;
+    std::move( extent(batch), back(mReady) );
+    batch.clear();
+    mData.notify_one();
+    return true;
+  }
+
+  walk_options             mOptions;
+  std::mutex               mMutex;
+  std::condition_variable  mWork, mSpace, mData;
+  types<FilePath>::list    mDirs;
+  size_t                   mPending;
+  bool                     mCancel;
+  types<dir_entry>::list   mReady;
+  types<dir_entry>::list   mOut;
+  size_t                   mOutPos;
+  std::vector<std::thread> mThreads;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// listDirectory
+
+// Lazy stream of the entries of one directory, in no particular order
+// Example: filter(&songFilter, map(&entryPath, listDirectory(dir)))
+inline stream<dir_entry> listDirectory( const FilePath& dirPath, const walk_options& options = walk_options() ) {
+  let dir = std::make_shared<__dir_reader__>( dirPath );
+  return stream<dir_entry>( [=]() -> Maybe<dir_entry> {
+    const char* name;
+    unsigned char type;
+    if ( !dir->valid() || !dir->next( name, type ) )
+      return Nothing();
+    dir_entry e;
+    __dirEntry__( *dir, dirPath, name, type, options.stat, e );
+    return e;
+  } );
+}
+
+///////////////////////////////////////////////////////////////////////////
+// walkDirectory
+
+// Lazy stream of every entry below a directory, excluding the directory
+// itself.  Subtrees are listed in parallel, ahead of the consumer by a
+// bounded number of entries, and in no particular order; symbolic links
+// are reported but not followed.
+inline stream<dir_entry> walkDirectory( const FilePath& dirPath, const walk_options& options = walk_options() ) {
+  let walk = std::make_shared<__dir_walk__>( dirPath, options );
+  return stream<dir_entry>( [=]() { return walk->next(); } );
+}
+
+inline const FilePath& entryPath( const dir_entry& e ) {
+  return e.path;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Batched file operations
+///////////////////////////////////////////////////////////////////////////
+
+enum file_op_kind {
+  FILE_REMOVE = 0,
+  FILE_COPY,
+  FILE_MOVE,
+  FILE_RENAME,
+};
+
+struct file_op {
+  file_op() : kind(FILE_REMOVE) { }
+  file_op( file_op_kind kind_, const FilePath& src_, const FilePath& dst_ = FilePath() )
+    : kind(kind_), src(src_), dst(dst_) { }
+
+  file_op_kind kind;
+  FilePath     src;
+  FilePath     dst;
+};
+
+inline file_op removeOp( const FilePath& filePath )                    { return file_op( FILE_REMOVE, filePath ); }
+inline file_op copyOp( const FilePath& srcPath, const FilePath& dstPath )   { return file_op( FILE_COPY,   srcPath, dstPath ); }
+inline file_op moveOp( const FilePath& srcPath, const FilePath& dstPath )   { return file_op( FILE_MOVE,   srcPath, dstPath ); }
+inline file_op renameOp( const FilePath& srcPath, const FilePath& dstPath ) { return file_op( FILE_RENAME, srcPath, dstPath ); }
+
+inline bool applyFileOp( const file_op& op ) {
+  switch ( op.kind ) {
+    case FILE_REMOVE: return removeFile( op.src );
+    case FILE_COPY:   return copyFile( op.src, op.dst );
+    case FILE_MOVE:   return moveFile( op.src, op.dst );
+    case FILE_RENAME: return renameFile( op.src, op.dst );
+    default:          return false;
+  }
+}
+
+// Calls f(i) for each i in [0,n) from up to threads threads
+template<typename F>
+inline void __forEachConcurrent__( size_t n, size_t threads, F f ) {
+  std::atomic<size_t> next(0);
+  let worker = [&]() {
+    for (size_t i; (i = next++) < n; )
+      f(i);
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < std::min(threads, n); ++t)
+    pool.push_back(std::thread(worker));
+  worker();
+  std::for_each(extent(pool), [](std::thread& t) { t.join(); });
+}
+
+#if FP_IO_URING
+// Minimal io_uring: one submission and one completion ring, at most
+// capacity() operations in flight
+class __io_ring__ {
+public:
+  explicit __io_ring__( unsigned entries ) : mFd(-1), mSq(MAP_FAILED), mCq(MAP_FAILED), mSqes(MAP_FAILED) {
+    io_uring_params p;
+    memset( &p, 0, sizeof(p) );
+    mFd = (int)syscall( __NR_io_uring_setup, entries, &p );
+    if ( mFd < 0 )
+      return;
+
+    mSqSize   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    mCqSize   = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    mSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if ( single )
+      mSqSize = mCqSize = std::max( mSqSize, mCqSize );
+    mSq   = mmap( nullptr, mSqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING );
+    mCq   = single ? mSq : mmap( nullptr, mCqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING );
+    mSqes = mmap( nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES );
+    if ( mSq == MAP_FAILED || mCq == MAP_FAILED || mSqes == MAP_FAILED ) {
+      close();
+      return;
+    }
+
+    char* sq = (char*)mSq;
+    char* cq = (char*)mCq;
+    mSqTail  = (unsigned*)(sq + p.sq_off.tail);
+    mSqMask  = *(unsigned*)(sq + p.sq_off.ring_mask);
+    mSqArray = (unsigned*)(sq + p.sq_off.array);
+    mCqHead  = (unsigned*)(cq + p.cq_off.head);
+    mCqTail  = (unsigned*)(cq + p.cq_off.tail);
+    mCqMask  = *(unsigned*)(cq + p.cq_off.ring_mask);
+    mCqes    = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    mEntries = p.sq_entries;
+  }
+  ~__io_ring__() { close(); }
+
+  bool     valid()    const { return mFd >= 0; }
+  unsigned capacity() const { return mEntries; }
+
+  // Queues op, a rename or a remove, tagged with i
+  void queue( const file_op& op, uint64_t i ) {
+    const unsigned tail  = *mSqTail;
+    const unsigned index = tail & mSqMask;
+    io_uring_sqe* sqe = (io_uring_sqe*)mSqes + index;
+    memset( sqe, 0, sizeof(*sqe) );
+    sqe->fd   = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)op.src.c_str();
+    if ( op.kind == FILE_REMOVE ) {
+      sqe->opcode = IORING_OP_UNLINKAT;
+    } else {
+      sqe->opcode = IORING_OP_RENAMEAT;
+      sqe->len    = (uint32_t)AT_FDCWD;
+      sqe->addr2  = (uint64_t)(uintptr_t)op.dst.c_str();
+    }
+    sqe->user_data = i;
+    mSqArray[index] = index;
+    __atomic_store_n( mSqTail, tail + 1, __ATOMIC_RELEASE );
+  }
+
+  // Submits the first n queued operations and waits for at least wait
+  // completions.  Returns how many operations the kernel took, which may be
+  // fewer than n, or -errno.
+  int submit( unsigned n, unsigned wait ) {
+    if ( n == 0 && wait == 0 )
+      return 0;
+    long taken;
+    while ( (taken = syscall( __NR_io_uring_enter, mFd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0 )) < 0 && errno == EINTR ) { }
+    return taken < 0 ? -errno : (int)taken;
+  }
+
+  bool pop( uint64_t& i, int& result ) {
+    const unsigned head = *mCqHead;
+    if ( head == __atomic_load_n( mCqTail, __ATOMIC_ACQUIRE ) )
+      return false;
+    const io_uring_cqe& cqe = mCqes[head & mCqMask];
+    i      = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n( mCqHead, head + 1, __ATOMIC_RELEASE );
+    return true;
+  }
+
+private:
+  __io_ring__( const __io_ring__& );
+  __io_ring__& operator=( const __io_ring__& );
+
+  void close() {
+    if ( mSqes != MAP_FAILED ) munmap( mSqes, mSqesSize );
+    if ( mCq != MAP_FAILED && mCq != mSq ) munmap( mCq, mCqSize );
+    if ( mSq != MAP_FAILED ) munmap( mSq, mSqSize );
+    if ( mFd >= 0 ) ::close( mFd );
+    mFd = -1;
+    mSq = mCq = mSqes = MAP_FAILED;
+  }
+
+  int           mFd;
+  void*         mSq;
+  void*         mCq;
+  void*         mSqes;
+  size_t        mSqSize, mCqSize, mSqesSize;
+  unsigned*     mSqTail;
+  unsigned*     mSqArray;
+  unsigned      mSqMask;
+  unsigned*     mCqHead;
+  unsigned*     mCqTail;
+  unsigned      mCqMask;
+  io_uring_cqe* mCqes;
+  unsigned      mEntries;
+};
+
+// Runs the renames and removes of ops through a ring, leaving in rest the
+// copies, cross-device moves and anything the kernel could not do.  If the
+// ring stops taking operations, those it has not taken are left in rest too.
+inline bool __applyRing__( const types<file_op>::list& ops, types<char>::list& results, types<size_t>::list& rest ) {
+  __io_ring__ ring( 256 );
+  if ( !ring.valid() )
+    return false;
+
+  // Queued operations the kernel has yet to take, oldest first
+  std::deque<size_t> queued;
+  size_t i = 0, inFlight = 0;
+  bool broken = false;
+  while ( inFlight > 0 || ( !broken && ( i < ops.size() || !queued.empty() ) ) ) {
+    if ( !broken ) {
+      for ( ; i < ops.size() && inFlight + queued.size() < ring.capacity(); ++i ) {
+        if ( ops[i].kind == FILE_COPY ) {
+          rest.push_back( i );
+        } else {
+          ring.queue( ops[i], i );
+          queued.push_back( i );
+        }
+      }
+      const int taken = ring.submit( (unsigned)queued.size(), inFlight + queued.size() > 0 ? 1 : 0 );
+      if ( taken > 0 ) {
+        queued.erase( queued.begin(), queued.begin() + taken );
+        inFlight += taken;
+      } else if ( inFlight == 0 || ( taken != -EAGAIN && taken != -EBUSY && taken != 0 ) ) {
+        // Short of resources with nothing left to wait for, or worse
+        broken = !queued.empty() || taken < 0;
+      }
+    } else {
+      // Operations already taken still post their completions
+      std::this_thread::yield();
+    }
+
+    uint64_t j;
+    int result;
+    while ( ring.pop( j, result ) ) {
+      --inFlight;
+      if ( result == 0 )
+        results[j] = 1;
+      else if ( result == -EXDEV || result == -EINVAL || result == -EOPNOTSUPP )
+        rest.push_back( (size_t)j );
+    }
+  }
+  if ( broken ) {
+    rest.insert( rest.end(), extent(queued) );
+    for ( ; i < ops.size(); ++i )
+      rest.push_back( i );
+  }
+  return true;
+}
+#endif /* FP_IO_URING */
+
+///////////////////////////////////////////////////////////////////////////
+// applyFileOps
+
+enum io_backend {
+  IO_AUTO = 0,
+  IO_THREADS,
+};
+
+// Applies a list of independent file operations, returning whether each
+// succeeded.  They run concurrently and in no particular order, so no
+// operation may depend on another in the same batch.  With IO_AUTO renames,
+// moves and removes go through io_uring when available; everything else
+// runs on FP_IO_THREADS threads.
+// Example: applyFileOps(map([&](const FilePath& f) { return moveOp(f, dir + f); }, files))
+inline types<bool>::list applyFileOps( const types<file_op>::list& ops, io_backend backend = IO_AUTO ) {
+  types<char>::list   results( ops.size(), 0 );
+  types<size_t>::list rest;
+
+  bool ringed = false;
+#if FP_IO_URING
+  ringed = backend == IO_AUTO && __applyRing__( ops, results, rest );
+#endif
+  if ( !ringed ) {
+    rest.resize( ops.size() );
+    std::iota( extent(rest), (size_t)0 );
+  }
+
+  __forEachConcurrent__( rest.size(), FP_IO_THREADS, [&](size_t j) {
+    results[rest[j]] = applyFileOp( ops[rest[j]] ) ? 1 : 0;
+  });
+  return types<bool>::list( extent(results) );
 }
 
 }
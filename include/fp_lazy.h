@@ -0,0 +1,332 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_LAZY_H_
+#define _FP_LAZY_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_composition_utils.h"
+#include "fp_maybe.h"
+#include "fp_stream.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Call-by-need
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+// lazy
+
+// A value computed on first use and kept: unlike a thunk, it is evaluated
+// at most once however often and from however many threads it is asked
+// for.  Copies share the value.  If the computation throws, the next use
+// tries again.
+// Example: let table = delay( [](){ return buildTable(); } ); use( *table );
+template<typename T>
+class lazy {
+public:
+  typedef T value_type;
+
+  explicit lazy(std::function<T()> f) : mCell(std::make_shared<cell>(std::move(f))) { }
+
+  const T& get() const {
+    cell& c = *mCell;
+    std::call_once(c.once, [&c]() {
+      c.value.reset(new T(c.make()));
+      c.make = nullptr;
+      c.ready.store(true, std::memory_order_release);
+    });
+    return *c.value;
+  }
+
+  const T& operator*()  const { return get(); }
+  const T* operator->() const { return &get(); }
+  const T& operator()() const { return get(); }
+
+  bool evaluated() const { return mCell->ready.load(std::memory_order_acquire); }
+
+private:
+  struct cell {
+    explicit cell(std::function<T()> f) : make(std::move(f)), ready(false) { }
+
+    std::function<T()> make;
+    std::once_flag     once;
+    std::unique_ptr<T> value;
+    std::atomic<bool>  ready;
+  };
+
+  std::shared_ptr<cell> mCell;
+};
+
+template<typename F>
+inline auto delay(F f) -> lazy< nonconstref_type_of(decltype(f())) > {
+  return lazy< nonconstref_type_of(decltype(f())) >(std::move(f));
+}
+
+template<typename T>
+inline const T& force(const lazy<T>& l) {
+  return l.get();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// lazy_list
+
+template<typename T> class lazy_list;
+
+// The elements of a lazy_list evaluated so far, in segments that never
+// move, so evaluated elements are read without a lock while later ones are
+// being computed.  Elements are computed in order, one thread at a time;
+// the generator for element i may read any element before i.
+template<typename T>
+class __lazy_cells__ : public std::enable_shared_from_this< __lazy_cells__<T> > {
+public:
+  typedef std::function<Maybe<T>(const lazy_list<T>&, size_t)> generator;
+
+  explicit __lazy_cells__(generator g) : mNext(std::move(g)), mReady(0), mDone(false), mBusy(false) {
+    for (size_t i = 0; i < Segments; ++i)
+      mSegments[i] = nullptr;
+  }
+
+  ~__lazy_cells__() {
+    const size_t n = mReady.load();
+    for (size_t i = 0; i < n; ++i)
+      at(i).~T();
+    for (size_t k = 0; k < Segments; ++k)
+      ::operator delete(mSegments[k].load());
+  }
+
+  // Whether there is an element i, evaluating up to it if need be
+  bool reach(size_t i) {
+    if (i < mReady.load(std::memory_order_acquire))
+      return true;
+    if (mDone.load(std::memory_order_acquire))
+      return false;
+
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    if (mBusy)
+      throw std::logic_error("lazy_list: an element depends on itself or a later one");
+    const lazy_list<T> self(this->shared_from_this(), 0);
+    for (size_t n = mReady.load(); n <= i && !mDone.load(); n = mReady.load()) {
+      busy guard(mBusy);
+      Maybe<T> t = mNext(self, n);
+      if (!t) {
+        mNext = nullptr;
+        mDone.store(true, std::memory_order_release);
+        break;
+      }
+      place(n, std::move(*t));
+      mReady.store(n + 1, std::memory_order_release);
+    }
+    return i < mReady.load();
+  }
+
+  const T& at(size_t i) const {
+    size_t offset;
+    const size_t k = segmentOf(i, offset);
+    return mSegments[k].load(std::memory_order_acquire)[offset];
+  }
+
+private:
+  static const size_t Segments = 40;
+
+  struct busy {
+    explicit busy(bool& b) : mBusy(b) { mBusy = true; }
+    ~busy() { mBusy = false; }
+    bool& mBusy;
+  };
+
+  // Element i lives in segment k, which holds 64 << k elements
+  static size_t segmentOf(size_t i, size_t& offset) {
+    const uint64_t j = (uint64_t)i / 64 + 1;
+    size_t k = 0;
+    while ((j >> (k + 1)) != 0) ++k;
+    offset = (size_t)(i - 64 * ((1ULL << k) - 1));
+    return k;
+  }
+
+  void place(size_t i, T t) {
+    size_t offset;
+    const size_t k = segmentOf(i, offset);
+    T* segment = mSegments[k].load();
+    if (!segment) {
+      segment = static_cast<T*>(::operator new(sizeof(T) * ((size_t)64 << k)));
+      mSegments[k].store(segment, std::memory_order_release);
+    }
+    new (segment + offset) T(std::move(t));
+  }
+
+  generator            mNext;
+  std::atomic<size_t>  mReady;
+  std::atomic<bool>    mDone;
+  bool                 mBusy;
+  std::atomic<T*>      mSegments[Segments];
+  std::recursive_mutex mMutex;
+};
+
+// A list evaluated on demand, one element at a time, and kept: indexing,
+// take and any number of traversals, from any number of threads, share the
+// elements computed so far.  It may be infinite; iterate it only through
+// take, takeWhile or index.  drop and tail share the elements too.
+// Example: fp::index( 90, fp::tabulate( []( const fp::lazy_list<uint64_t>& fibs, size_t i ) {
+//            return i < 2 ? (uint64_t)i : fibs[i - 1] + fibs[i - 2]; } ) )
+template<typename T>
+class lazy_list {
+public:
+  typedef T                                         value_type;
+  typedef typename __lazy_cells__<T>::generator     generator;
+
+  class const_iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef T                         value_type;
+    typedef ptrdiff_t                 difference_type;
+    typedef const T*                  pointer;
+    typedef const T&                  reference;
+
+    const_iterator() : mList(nullptr), mIndex(0) { }
+    const_iterator(const lazy_list* l, size_t i) : mList(l), mIndex(i) { }
+
+    const T& operator*()  const { return (*mList)[mIndex]; }
+    const T* operator->() const { return &(*mList)[mIndex]; }
+
+    const_iterator& operator++()    { ++mIndex; return *this; }
+    const_iterator  operator++(int) { const_iterator it(*this); ++mIndex; return it; }
+
+    // The end iterator has no list; any other is at the end once the list
+    // has no element there
+    bool operator==(const const_iterator& o) const {
+      if (mList && o.mList) return mIndex == o.mIndex;
+      if (mList)            return !mList->has(mIndex);
+      if (o.mList)          return !o.mList->has(o.mIndex);
+      return true;
+    }
+    bool operator!=(const const_iterator& o) const { return !(*this == o); }
+
+  private:
+    const lazy_list* mList;
+    size_t           mIndex;
+  };
+
+  explicit lazy_list(generator g) : mCells(std::make_shared< __lazy_cells__<T> >(std::move(g))), mOffset(0) { }
+  lazy_list(std::shared_ptr< __lazy_cells__<T> > cells, size_t offset) : mCells(std::move(cells)), mOffset(offset) { }
+
+  // The element at i; out_of_range past the end of a finite list
+  const T& operator[](size_t i) const {
+    if (!mCells->reach(mOffset + i))
+      throw std::out_of_range("lazy_list");
+    return mCells->at(mOffset + i);
+  }
+
+  bool has(size_t i)  const { return mCells->reach(mOffset + i); }
+  bool empty()        const { return !has(0); }
+
+  lazy_list drop(size_t n) const { return lazy_list(mCells, mOffset + n); }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end()   const { return const_iterator(); }
+
+private:
+  std::shared_ptr< __lazy_cells__<T> > mCells;
+  size_t                               mOffset;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// lazyList
+
+// The values of a generator, kept as they are produced
+template<typename T>
+inline lazy_list<T> lazyList(std::function<T()> f) {
+  return lazy_list<T>([=](const lazy_list<T>&, size_t) { return just(f()); });
+}
+template<typename T>
+inline lazy_list<T> lazyList(stream<T> s) {
+  return lazy_list<T>([=](const lazy_list<T>&, size_t) { return s(); });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// tabulate
+
+// The infinite list whose element i is f(list, i): each element may be
+// defined by the ones before it, as in dynamic programming
+template<typename F>
+inline auto tabulate(F f) -> lazy_list< nonconstref_type_of(typename function_traits<F>::result_type) > {
+  typedef nonconstref_type_of(typename function_traits<F>::result_type) T;
+  return lazy_list<T>([=](const lazy_list<T>& self, size_t i) { return just<T>(f(self, i)); });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// index
+
+template<typename Index, typename T>
+inline T index(Index i, const lazy_list<T>& l) {
+  return l[(size_t)i];
+}
+
+///////////////////////////////////////////////////////////////////////////
+// take
+
+template<typename T>
+inline typename types<T>::list take(size_t n, const lazy_list<T>& l) {
+  typename types<T>::list result;
+  for (size_t i = 0; i < n && l.has(i); ++i)
+    result.push_back(l[i]);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// takeWhile
+
+template<typename F, typename T>
+inline typename types<T>::list takeWhile(F f, const lazy_list<T>& l) {
+  typename types<T>::list result;
+  for (size_t i = 0; l.has(i) && f(l[i]); ++i)
+    result.push_back(l[i]);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// drop
+
+template<typename T>
+inline lazy_list<T> drop(size_t n, const lazy_list<T>& l) {
+  return l.drop(n);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// map
+
+template<typename F, typename T>
+inline auto map(F f, lazy_list<T> l) -> lazy_list< nonconstref_type_of(decltype(f(std::declval<T>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>()))) U;
+  return lazy_list<U>([=](const lazy_list<U>&, size_t i) {
+    return l.has(i) ? just<U>(f(l[i])) : Maybe<U>();
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// zipWith
+
+template<typename F, typename T, typename U>
+inline auto zipWith(F f, lazy_list<T> t, lazy_list<U> u)
+  -> lazy_list< nonconstref_type_of(decltype(f(std::declval<T>(), std::declval<U>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>(), std::declval<U>()))) V;
+  return lazy_list<V>([=](const lazy_list<V>&, size_t i) {
+    return t.has(i) && u.has(i) ? just<V>(f(t[i], u[i])) : Maybe<V>();
+  });
+}
+
+} /* namespace fp */
+
+#endif /* _FP_LAZY_H_ */
@@ -0,0 +1,572 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_MATCH_H_
+#define _FP_MATCH_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_read.h"
+#include "fp_string_ref.h"
+
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <stdint.h>
+
+#if FP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Path matching
+///////////////////////////////////////////////////////////////////////////
+
+inline char __foldCase__(char c) {
+  return (unsigned char)(c - 'A') < 26 ? (char)(c + ('a' - 'A')) : c;
+}
+
+inline bool __isSeparator__(char c) {
+  return c == '/' || c == '\\';
+}
+
+// The file name of a path: everything after the last separator
+inline string_ref fileNameOf(const string_ref& path) {
+  const char* p = path.end();
+  while (p != path.begin() && !__isSeparator__(p[-1])) --p;
+  return string_ref(p, path.end());
+}
+
+///////////////////////////////////////////////////////////////////////////
+// extension_set
+
+// Set of file extensions, compiled into a perfect hash: extensions of up
+// to eight chars are packed into a 64-bit key, and a multiplier is chosen
+// so that no two keys share a slot, so a lookup is one multiply and one
+// compare.  Longer extensions fall back to a sorted list.
+// Example: filter(extensionSet(list("mp3", "flac")), paths)
+class extension_set {
+public:
+  extension_set() : mIgnoreCase(true), mMultiplier(0), mShift(63), mMaxLength(0), mSlots(2, 0) { }
+
+  template<typename C>
+  explicit extension_set(const C& extensions, bool ignoreCase = true)
+    : mIgnoreCase(ignoreCase), mMultiplier(0), mShift(63), mMaxLength(0) {
+    types<uint64_t>::list keys;
+    for (let it = begin(extensions); it != end(extensions); ++it) {
+      string_ref ext(*it);
+      if (!ext.empty() && ext[0] == '.') ext = ext.substr(1);
+      if (ext.empty()) continue;
+      mMaxLength = std::max(mMaxLength, ext.size());
+      if (ext.size() <= 8) {
+        keys.push_back(key(ext));
+      } else {
+        mLong.push_back(mIgnoreCase ? fold(ext) : ext.str());
+      }
+    }
+    std::sort(extent(keys));
+    keys.erase(std::unique(extent(keys)), end(keys));
+    std::sort(extent(mLong));
+    build(keys);
+  }
+
+  // Whether path ends in one of the extensions
+  bool operator()(const string_ref& path) const {
+    const char* last = path.end();
+    const char* p    = last;
+    while (p != path.begin()) {
+      const char c = *--p;
+      if (c == '.')
+        return contains(string_ref(p + 1, last));
+      if (__isSeparator__(c) || (size_t)(last - p) > mMaxLength)
+        return false;
+    }
+    return false;
+  }
+
+  // Whether ext, without the dot, is in the set
+  bool contains(const string_ref& ext) const {
+    if (ext.empty() || ext.size() > mMaxLength)
+      return false;
+    if (ext.size() <= 8) {
+      const uint64_t k = key(ext);
+      return mSlots[slot(k)] == k;
+    }
+    return std::binary_search(extent(mLong), mIgnoreCase ? fold(ext) : ext.str());
+  }
+
+private:
+  uint64_t key(const string_ref& ext) const {
+    uint64_t k = 0;
+    for (size_t i = 0; i < ext.size(); ++i) {
+      const char c = mIgnoreCase ? __foldCase__(ext[i]) : ext[i];
+      k |= (uint64_t)(unsigned char)c << (8 * i);
+    }
+    return k;
+  }
+
+  string fold(const string_ref& s) const {
+    string result(s.size(), '\0');
+    std::transform(extent(s), begin(result), &__foldCase__);
+    return result;
+  }
+
+  inline size_t slot(uint64_t k) const { return (size_t)((k * mMultiplier) >> mShift); }
+
+  void build(const types<uint64_t>::list& keys) {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (unsigned bits = 1; ; ++bits) {
+      if (((size_t)1 << bits) < 2 * keys.size())
+        continue;
+      mShift = 64 - bits;
+      for (int attempt = 0; attempt < 64; ++attempt) {
+        seed += 0x9E3779B97F4A7C15ULL;
+        mMultiplier = (seed ^ (seed >> 29)) | 1;
+        mSlots.assign((size_t)1 << bits, 0);
+        bool perfect = true;
+        for (size_t i = 0; i < keys.size() && perfect; ++i) {
+          uint64_t& s = mSlots[slot(keys[i])];
+          perfect = s == 0;
+          s = keys[i];
+        }
+        if (perfect)
+          return;
+      }
+    }
+  }
+
+  bool                  mIgnoreCase;
+  uint64_t              mMultiplier;
+  unsigned              mShift;
+  size_t                mMaxLength;
+  types<uint64_t>::list mSlots;
+  types<string>::list   mLong;
+};
+
+template<typename C>
+inline extension_set extensionSet(const C& extensions, bool ignoreCase = true) {
+  return extension_set(extensions, ignoreCase);
+}
+inline extension_set extensionSet(const string& extension, bool ignoreCase = true) {
+  return extension_set(types<string>::list(1, extension), ignoreCase);
+}
+inline extension_set extensionSet(const char* extension, bool ignoreCase = true) {
+  return extensionSet(string(extension), ignoreCase);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// glob_set
+
+// A DFA over bytes, compiled from glob patterns by subset construction;
+// bytes that no pattern tells apart share a column of the table.
+class __glob_dfa__ {
+public:
+  __glob_dfa__() : mStart(0), mClasses(1), mNext(1, 0), mAccept(1, 0) {
+    std::fill(mClass, mClass + 256, (unsigned char)0);
+  }
+
+  bool matches(const char* p, const char* last) const {
+    uint32_t s = mStart;
+    for (; p != last && s != 0; ++p)
+      s = mNext[s * mClasses + mClass[(unsigned char)*p]];
+    return mAccept[s] != 0;
+  }
+
+  struct token {
+    token() : star(false) { }
+    bool            star;   // Repeats zero or more times
+    std::bitset<256> chars;
+  };
+  typedef types<token>::list pattern;
+
+  void build(const types<pattern>::list& patterns) {
+    // Positions: pattern k after i tokens; the last one of each accepts
+    types<const token*>::list tokenAt;
+    types<uint32_t>::list     starts;
+    for (size_t k = 0; k < patterns.size(); ++k) {
+      starts.push_back((uint32_t)tokenAt.size());
+      for (size_t i = 0; i < patterns[k].size(); ++i)
+        tokenAt.push_back(&patterns[k][i]);
+      tokenAt.push_back(nullptr);
+    }
+
+    // Byte classes: bytes with the same membership in every token's set
+    std::map<string, unsigned> signatures;
+    for (unsigned b = 0; b < 256; ++b) {
+      string sig;
+      for (size_t i = 0; i < tokenAt.size(); ++i)
+        sig.push_back(tokenAt[i] && tokenAt[i]->chars[b] ? '1' : '0');
+      let it = signatures.insert(std::make_pair(sig, (unsigned)signatures.size())).first;
+      mClass[b] = (unsigned char)it->second;
+    }
+    mClasses = signatures.size();
+    types<unsigned char>::list representative(mClasses);
+    for (int b = 255; b >= 0; --b)
+      representative[mClass[b]] = (unsigned char)b;
+
+    typedef types<uint32_t>::list state;
+    let closure = [&](state& s) {
+      for (size_t i = 0; i < s.size(); ++i) {
+        const token* t = tokenAt[s[i]];
+        if (t && t->star && std::find(extent(s), s[i] + 1) == end(s))
+          s.push_back(s[i] + 1);
+      }
+      std::sort(extent(s));
+    };
+
+    std::map<state, uint32_t> ids;
+    types<state>::list states;
+    let add = [&](state& s) -> uint32_t {
+      closure(s);
+      let it = ids.find(s);
+      if (it != end(ids))
+        return it->second;
+      const uint32_t id = (uint32_t)states.size();
+      ids.insert(std::make_pair(s, id));
+      states.push_back(s);
+      return id;
+    };
+
+    state dead;
+    add(dead);
+    state start(starts);
+    mStart = add(start);
+
+    mNext.clear();
+    for (size_t id = 0; id < states.size(); ++id) {
+      for (size_t c = 0; c < mClasses; ++c) {
+        const unsigned char b = representative[c];
+        state next;
+        const state current = states[id];
+        for (size_t i = 0; i < current.size(); ++i) {
+          const token* t = tokenAt[current[i]];
+          if (t && t->chars[b])
+            next.push_back(t->star ? current[i] : current[i] + 1);
+        }
+        std::sort(extent(next));
+        next.erase(std::unique(extent(next)), end(next));
+        mNext.push_back(add(next));
+      }
+    }
+
+    mAccept.assign(states.size(), 0);
+    for (size_t id = 0; id < states.size(); ++id) {
+      for (size_t i = 0; i < states[id].size(); ++i)
+        mAccept[id] |= tokenAt[states[id][i]] == nullptr;
+    }
+  }
+
+private:
+  uint32_t               mStart;
+  size_t                 mClasses;
+  unsigned char          mClass[256];
+  types<uint32_t>::list  mNext;
+  types<char>::list      mAccept;
+};
+
+// Set of glob patterns, compiled into one DFA.  '*' matches any run of
+// chars within a path component, '**' any run at all, '?' one char, and
+// [abc], [a-z] or [!a-z] one char from a set; '\' escapes the next char.
+// Patterns without a '/' match the file name, others the whole path.
+// Example: filter(globSet("*.mp3"), paths)
+class glob_set {
+public:
+  glob_set() { }
+
+  template<typename C>
+  explicit glob_set(const C& patterns, bool ignoreCase = false) {
+    types<__glob_dfa__::pattern>::list names, paths;
+    for (let it = begin(patterns); it != end(patterns); ++it) {
+      const string_ref p(*it);
+      (std::find(extent(p), '/') != end(p) ? paths : names).push_back(parse(p, ignoreCase));
+    }
+    mNames.build(names);
+    mPaths.build(paths);
+  }
+
+  bool operator()(const string_ref& path) const {
+    const string_ref name = fileNameOf(path);
+    return mNames.matches(extent(name)) || mPaths.matches(extent(path));
+  }
+
+private:
+  static __glob_dfa__::pattern parse(const string_ref& p, bool ignoreCase) {
+    __glob_dfa__::pattern tokens;
+    std::bitset<256> notSeparator;
+    notSeparator.set();
+    notSeparator.reset('/');
+
+    for (size_t i = 0; i < p.size(); ++i) {
+      __glob_dfa__::token t;
+      const char c = p[i];
+      if (c == '*') {
+        t.star  = true;
+        t.chars = notSeparator;
+        if (i + 1 < p.size() && p[i + 1] == '*') {
+          t.chars.set();
+          ++i;
+        }
+        // Adjacent stars add nothing
+        if (!tokens.empty() && tokens.back().star && (tokens.back().chars | t.chars) == tokens.back().chars)
+          continue;
+      } else if (c == '?') {
+        t.chars = notSeparator;
+      } else if (c == '[' && std::find(p.begin() + i + 1, p.end(), ']') != p.end()) {
+        size_t j = i + 1;
+        const bool negate = j < p.size() && (p[j] == '!' || p[j] == '^');
+        if (negate) ++j;
+        for (bool first = true; j < p.size() && (first || p[j] != ']'); first = false, ++j) {
+          unsigned char lo = (unsigned char)p[j], hi = lo;
+          if (j + 2 < p.size() && p[j + 1] == '-' && p[j + 2] != ']') {
+            hi = (unsigned char)p[j + 2];
+            j += 2;
+          }
+          for (unsigned b = lo; b <= hi; ++b)
+            t.chars.set(b);
+        }
+        if (negate) t.chars = ~t.chars & notSeparator;
+        i = j;
+      } else {
+        const char literal = (c == '\\' && i + 1 < p.size()) ? p[++i] : c;
+        t.chars.set((unsigned char)literal);
+      }
+      if (ignoreCase) {
+        for (unsigned b = 'a'; b <= 'z'; ++b) {
+          if (t.chars[b] || t.chars[b - 'a' + 'A']) {
+            t.chars.set(b);
+            t.chars.set(b - 'a' + 'A');
+          }
+        }
+      }
+      tokens.push_back(t);
+    }
+    return tokens;
+  }
+
+  __glob_dfa__ mNames;
+  __glob_dfa__ mPaths;
+};
+
+template<typename C>
+inline glob_set globSet(const C& patterns, bool ignoreCase = false) {
+  return glob_set(patterns, ignoreCase);
+}
+inline glob_set globSet(const string& pattern, bool ignoreCase = false) {
+  return glob_set(types<string>::list(1, pattern), ignoreCase);
+}
+inline glob_set globSet(const char* pattern, bool ignoreCase = false) {
+  return globSet(string(pattern), ignoreCase);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Text search
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+// keyword_set
+
+// Set of keywords compiled into one Aho-Corasick automaton, so a text is
+// searched for all of them in a single pass: one table lookup per byte
+// whatever the number of keywords.  Bytes that no keyword uses share a
+// column of the table, and while no keyword is partly matched the scan
+// skips ahead to the next byte that starts one (16 at a time with SSE2
+// when few bytes do).  As a predicate it tells whether a text contains
+// any keyword; find() gives every occurrence, overlapping ones included.
+// Example: filter(keywordSet(list("error", "fatal")), lines(log))
+class keyword_set {
+public:
+  // An occurrence of keyword number pattern starting at position
+  struct match {
+    size_t position;
+    size_t pattern;
+  };
+
+  keyword_set() : mClasses(1), mNext(1, 0), mAccept(1, 0), mPattern(1, NONE), mDict(1, 0) {
+    std::fill(mClass, mClass + 256, (uint16_t)0);
+    std::fill(mStart, mStart + 256, false);
+  }
+
+  template<typename C>
+  explicit keyword_set(const C& patterns, bool ignoreCase = false) {
+    types<string_ref>::list keywords;
+    for (let it = begin(patterns); it != end(patterns); ++it)
+      keywords.push_back(string_ref(*it));
+    build(keywords, ignoreCase);
+  }
+
+  // Whether text contains any of the keywords
+  bool operator()(const string_ref& text) const {
+    const unsigned char* p    = (const unsigned char*)text.data();
+    const unsigned char* last = p + text.size();
+    uint32_t s = 0;
+    while (p != last) {
+      if (s == 0 && (p = skip(p, last)) == last)
+        break;
+      s = mNext[s * mClasses + mClass[*p++]];
+      if (mAccept[s])
+        return true;
+    }
+    return false;
+  }
+
+  // Every occurrence of every keyword, by end position; a keyword given
+  // more than once is reported as its first copy
+  types<match>::list find(const string_ref& text) const {
+    types<match>::list result;
+    const unsigned char* first = (const unsigned char*)text.data();
+    const unsigned char* last  = first + text.size();
+    const unsigned char* p     = first;
+    uint32_t s = 0;
+    while (p != last) {
+      if (s == 0 && (p = skip(p, last)) == last)
+        break;
+      s = mNext[s * mClasses + mClass[*p++]];
+      if (!mAccept[s])
+        continue;
+      for (uint32_t t = mPattern[s] != NONE ? s : mDict[s]; t != 0; t = mDict[t]) {
+        match m = { (size_t)(p - first) - mLengths[mPattern[t]], mPattern[t] };
+        result.push_back(m);
+      }
+    }
+    return result;
+  }
+
+  // find() as a function object, for mapping over lines
+  struct finder {
+    const keyword_set* set;
+    types<match>::list operator()(const string_ref& text) const { return set->find(text); }
+  };
+  finder positions() const { finder f = { this }; return f; }
+
+  size_t size() const { return mLengths.size(); }
+
+private:
+  enum : uint32_t { NONE = 0xFFFFFFFF };
+
+  void build(const types<string_ref>::list& keywords, bool ignoreCase) {
+    // Byte classes: one per byte used by a keyword, case folded together
+    // if asked, and one for every other byte, so up to 257 of them
+    std::fill(mClass, mClass + 256, (uint16_t)0);
+    mClasses = 1;
+    for (size_t k = 0; k < keywords.size(); ++k) {
+      for (size_t i = 0; i < keywords[k].size(); ++i) {
+        const unsigned char b = (unsigned char)(ignoreCase ? __foldCase__(keywords[k][i]) : keywords[k][i]);
+        if (mClass[b] == 0)
+          mClass[b] = (uint16_t)mClasses++;
+      }
+    }
+    if (ignoreCase) {
+      for (unsigned b = 'a'; b <= 'z'; ++b)
+        mClass[b - 'a' + 'A'] = mClass[b];
+    }
+
+    // The trie, with NONE for missing edges
+    mNext.assign(mClasses, NONE);
+    mPattern.assign(1, NONE);
+    mLengths.clear();
+    for (size_t k = 0; k < keywords.size(); ++k) {
+      mLengths.push_back(keywords[k].size());
+      if (keywords[k].empty())
+        continue;
+      uint32_t s = 0;
+      for (size_t i = 0; i < keywords[k].size(); ++i) {
+        uint32_t& next = mNext[s * mClasses + mClass[(unsigned char)keywords[k][i]]];
+        if (next == NONE) {
+          next = (uint32_t)mPattern.size();
+          mPattern.push_back(NONE);
+          mNext.resize(mNext.size() + mClasses, NONE);
+        }
+        s = mNext[s * mClasses + mClass[(unsigned char)keywords[k][i]]];
+      }
+      if (mPattern[s] == NONE)
+        mPattern[s] = (uint32_t)k;
+    }
+
+    // Breadth first, every missing edge takes the edge of the longest
+    // proper suffix that is also in the trie
+    const size_t states = mPattern.size();
+    types<uint32_t>::list fail(states, 0), queue;
+    mAccept.assign(states, 0);
+    mDict.assign(states, 0);
+    for (size_t c = 0; c < mClasses; ++c) {
+      uint32_t& next = mNext[c];
+      if (next == NONE) {
+        next = 0;
+      } else {
+        queue.push_back(next);
+      }
+    }
+    for (size_t q = 0; q < queue.size(); ++q) {
+      const uint32_t s = queue[q];
+      mAccept[s] = mPattern[s] != NONE || mAccept[fail[s]];
+      for (size_t c = 0; c < mClasses; ++c) {
+        uint32_t& next = mNext[s * mClasses + c];
+        const uint32_t fallback = mNext[fail[s] * mClasses + c];
+        if (next == NONE) {
+          next = fallback;
+        } else {
+          fail[next]  = fallback;
+          mDict[next] = mPattern[fallback] != NONE ? fallback : mDict[fallback];
+          queue.push_back(next);
+        }
+      }
+    }
+
+    for (unsigned b = 0; b < 256; ++b)
+      mStart[b] = mNext[mClass[b]] != 0;
+    mStartBytes.clear();
+    for (unsigned b = 0; b < 256 && mStartBytes.size() <= 4; ++b) {
+      if (mStart[b]) mStartBytes.push_back((unsigned char)b);
+    }
+  }
+
+  // The first byte from p that starts a keyword
+  const unsigned char* skip(const unsigned char* p, const unsigned char* last) const {
+#if FP_SSE2
+    if (mStartBytes.size() <= 4) {
+      while (last - p >= 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)p);
+        __m128i any = _mm_setzero_si128();
+        for (size_t i = 0; i < mStartBytes.size(); ++i)
+          any = _mm_or_si128(any, _mm_cmpeq_epi8(x, _mm_set1_epi8((char)mStartBytes[i])));
+        const int mask = _mm_movemask_epi8(any);
+        if (mask != 0)
+          return p + __ctz64__((uint64_t)mask);
+        p += 16;
+      }
+    }
+#endif
+    while (p != last && !mStart[*p]) ++p;
+    return p;
+  }
+
+  uint16_t                    mClass[256];
+  bool                        mStart[256];
+  types<unsigned char>::list  mStartBytes;
+  size_t                      mClasses;
+  types<uint32_t>::list       mNext;
+  types<char>::list           mAccept;
+  types<uint32_t>::list       mPattern;
+  types<uint32_t>::list       mDict;
+  types<size_t>::list         mLengths;
+};
+
+template<typename C>
+inline keyword_set keywordSet(const C& keywords, bool ignoreCase = false) {
+  return keyword_set(keywords, ignoreCase);
+}
+inline keyword_set keywordSet(const string& keyword, bool ignoreCase = false) {
+  return keyword_set(types<string>::list(1, keyword), ignoreCase);
+}
+inline keyword_set keywordSet(const char* keyword, bool ignoreCase = false) {
+  return keywordSet(string(keyword), ignoreCase);
+}
+
+} /* namespace fp */
+
+#endif /* _FP_MATCH_H_ */
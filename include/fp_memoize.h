@@ -0,0 +1,363 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_MEMOIZE_H_
+#define _FP_MEMOIZE_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+#if FP_VARIADIC
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Memoization
+///////////////////////////////////////////////////////////////////////////
+
+// Hash of a tuple of arguments, from the std::hash of each, mixed so that
+// identity hashes of small integers spread over shards and slots
+template<size_t I, typename Tuple>
+struct __tuple_hash__ {
+  static uint64_t hash(const Tuple& t) {
+    typedef typename std::tuple_element<I - 1, Tuple>::type T;
+    const uint64_t h = __tuple_hash__<I - 1, Tuple>::hash(t);
+    return (h ^ (uint64_t)std::hash<T>()(std::get<I - 1>(t))) * 0x9E3779B97F4A7C15ULL;
+  }
+};
+template<typename Tuple>
+struct __tuple_hash__<0, Tuple> {
+  static uint64_t hash(const Tuple&) { return 0; }
+};
+
+template<typename... Args>
+inline uint64_t __hashTuple__(const std::tuple<Args...>& t) {
+  const uint64_t h = __tuple_hash__<sizeof...(Args), std::tuple<Args...> >::hash(t);
+  return h ^ (h >> 29);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// memo_cache
+
+// Concurrent map from K to V, split into shards by hash.  find takes no
+// lock: each shard is an open addressing table of entry pointers that
+// readers probe inside a read section, and a shard's writers take its
+// mutex.  With a capacity, each shard keeps about capacity / Shards
+// entries, evicting with the CLOCK policy: inserts and hits mark an entry,
+// and the clock hand spares marked entries once, clearing the mark as it
+// passes.  Unlinked entries and outgrown tables are freed once every read
+// section that might still see them has ended.
+template<typename K, typename V>
+class memo_cache {
+public:
+  explicit memo_cache(size_t capacity = 0)
+    : mShardCapacity(capacity == 0 ? 0 : (capacity + Shards - 1) / Shards) { }
+
+  ~memo_cache() {
+    for (size_t i = 0; i < Shards; ++i) {
+      table* t = mShards[i].current.load();
+      for (size_t j = 0; j <= t->mask; ++j) {
+        entry* e = t->slots[j].load();
+        if (e && e != deleted())
+          delete e;
+      }
+      delete t;
+    }
+  }
+
+  Maybe<V> find(const K& k) const {
+    const uint64_t h = __hashTuple__(k);
+    shard& s = shardOf(h);
+    const read_section section(s);
+    const table* t = s.current.load();
+    for (size_t i = h & t->mask; ; i = (i + 1) & t->mask) {
+      entry* e = t->slots[i].load();
+      if (!e)
+        break;
+      if (e != deleted() && e->hash == h && e->key == k) {
+        if (!e->referenced.load(std::memory_order_relaxed))
+          e->referenced.store(true, std::memory_order_relaxed);
+        s.hits.fetch_add(1, std::memory_order_relaxed);
+        return just(e->value);
+      }
+    }
+    s.misses.fetch_add(1, std::memory_order_relaxed);
+    return Nothing();
+  }
+
+  // Adds k unless it is already there
+  void insert(K k, V v) {
+    const uint64_t h = __hashTuple__(k);
+    shard& s = shardOf(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    table* t = s.current.load();
+    size_t free = NoSlot;
+    size_t i = h & t->mask;
+    for (; ; i = (i + 1) & t->mask) {
+      entry* e = t->slots[i].load();
+      if (!e)
+        break;
+      if (e == deleted()) {
+        if (free == NoSlot) free = i;
+      } else if (e->hash == h && e->key == k) {
+        return;
+      }
+    }
+    if (free == NoSlot) {
+      // Keep at least a quarter of the slots empty so probes stay short
+      // and always end
+      if (4 * (s.used + 1) > 3 * (t->mask + 1)) {
+        rebuild(s);
+        t = s.current.load();
+        for (i = h & t->mask; t->slots[i].load(); i = (i + 1) & t->mask) { }
+      }
+      free = i;
+      ++s.used;
+    }
+    t->slots[free].store(new entry(h, std::move(k), std::move(v)));
+    ++s.live;
+
+    if (mShardCapacity != 0 && s.live > mShardCapacity)
+      evict(s);
+    reclaim(s);
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < Shards; ++i) {
+      std::lock_guard<std::mutex> lock(mShards[i].mutex);
+      n += mShards[i].live;
+    }
+    return n;
+  }
+
+  uint64_t hits() const {
+    uint64_t n = 0;
+    for (size_t i = 0; i < Shards; ++i)
+      n += mShards[i].hits.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  uint64_t misses() const {
+    uint64_t n = 0;
+    for (size_t i = 0; i < Shards; ++i)
+      n += mShards[i].misses.load(std::memory_order_relaxed);
+    return n;
+  }
+
+private:
+  memo_cache(const memo_cache&);
+  memo_cache& operator=(const memo_cache&);
+
+  static const size_t Shards = 16;
+  static const size_t NoSlot = ~(size_t)0;
+
+  struct entry {
+    entry(uint64_t h, K k, V v) : hash(h), key(std::move(k)), value(std::move(v)), referenced(true) { }
+
+    uint64_t          hash;
+    K                 key;
+    V                 value;
+    std::atomic<bool> referenced;
+  };
+
+  // An evicted entry's slot; never dereferenced
+  static entry* deleted() { return reinterpret_cast<entry*>((uintptr_t)1); }
+
+  struct table {
+    explicit table(size_t slots) : mask(slots - 1), slots(new std::atomic<entry*>[slots]) {
+      for (size_t i = 0; i < slots; ++i)
+        this->slots[i] = nullptr;
+    }
+
+    size_t                                 mask;
+    std::unique_ptr<std::atomic<entry*>[]> slots;
+  };
+
+  // Readers count themselves in one of two counters, picked by the shard's
+  // epoch.  A writer that has unlinked something moves the epoch on and
+  // waits for the old counter to drain: any reader still able to see what
+  // was unlinked entered under the old epoch, and a reader that entered
+  // under an even older one held up the writer before.
+  struct shard {
+    shard() : current(new table(16)), epoch(0), hits(0), misses(0), used(0), live(0), hand(0) {
+      readers[0] = 0;
+      readers[1] = 0;
+    }
+
+    std::atomic<table*>   current;
+    std::atomic<unsigned> epoch;
+    std::atomic<size_t>   readers[2];
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+
+    mutable std::mutex    mutex;
+    size_t                used;  // Slots holding an entry or deleted()
+    size_t                live;
+    size_t                hand;
+    typename types<entry*>::list retiredEntries;
+    typename types<table*>::list retiredTables;
+
+    char                  padding[64];
+  };
+
+  class read_section {
+  public:
+    explicit read_section(shard& s) : mShard(s) {
+      for (;;) {
+        mEpoch = s.epoch.load();
+        s.readers[mEpoch & 1].fetch_add(1);
+        if (s.epoch.load() == mEpoch)
+          return;
+        s.readers[mEpoch & 1].fetch_sub(1);
+      }
+    }
+    ~read_section() { mShard.readers[mEpoch & 1].fetch_sub(1); }
+
+  private:
+    shard&   mShard;
+    unsigned mEpoch;
+  };
+
+  shard& shardOf(uint64_t h) const { return mShards[h >> 60]; }
+
+  // Moves the live entries to a table sized for them; the old one is
+  // retired, as readers may still be probing it
+  void rebuild(shard& s) {
+    table* old = s.current.load();
+    size_t slots = 16;
+    while (8 * (s.live + 1) > 3 * slots) slots *= 2;
+    table* t = new table(slots);
+    for (size_t i = 0; i <= old->mask; ++i) {
+      entry* e = old->slots[i].load();
+      if (!e || e == deleted())
+        continue;
+      size_t j = e->hash & t->mask;
+      while (t->slots[j].load()) j = (j + 1) & t->mask;
+      t->slots[j].store(e);
+    }
+    s.current.store(t);
+    s.retiredTables.push_back(old);
+    s.used = s.live;
+    s.hand = 0;
+  }
+
+  // Sweeps the clock hand until the shard is an eighth under capacity, so
+  // the cost of waiting out readers is shared by a batch of evictions
+  void evict(shard& s) {
+    table* t = s.current.load();
+    const size_t target = mShardCapacity - mShardCapacity / 8;
+    while (s.live > target) {
+      std::atomic<entry*>& slot = t->slots[s.hand];
+      s.hand = (s.hand + 1) & t->mask;
+      entry* e = slot.load();
+      if (!e || e == deleted())
+        continue;
+      if (e->referenced.load(std::memory_order_relaxed)) {
+        e->referenced.store(false, std::memory_order_relaxed);
+        continue;
+      }
+      slot.store(deleted());
+      --s.live;
+      s.retiredEntries.push_back(e);
+    }
+  }
+
+  void reclaim(shard& s) {
+    if (s.retiredEntries.empty() && s.retiredTables.empty())
+      return;
+    const unsigned e = s.epoch.load();
+    s.epoch.store(e + 1);
+    while (s.readers[e & 1].load() != 0)
+      std::this_thread::yield();
+    for (size_t i = 0; i < s.retiredEntries.size(); ++i)
+      delete s.retiredEntries[i];
+    for (size_t i = 0; i < s.retiredTables.size(); ++i)
+      delete s.retiredTables[i];
+    s.retiredEntries.clear();
+    s.retiredTables.clear();
+  }
+
+  const size_t             mShardCapacity;
+  mutable shard            mShards[Shards];
+};
+
+///////////////////////////////////////////////////////////////////////////
+// memoize
+
+template<typename F>
+struct __memo_traits__ : public __memo_traits__< decltype(&F::operator()) > { };
+template<typename C, typename R, typename... Args>
+struct __memo_traits__<R(C::*)(Args...) const> {
+  typedef R                                                   result_type;
+  typedef std::tuple<typename std::decay<Args>::type...>      key_type;
+};
+template<typename C, typename R, typename... Args>
+struct __memo_traits__<R(C::*)(Args...)> : public __memo_traits__<R(C::*)(Args...) const> { };
+template<typename R, typename... Args>
+struct __memo_traits__<R(*)(Args...)> {
+  typedef R                                                   result_type;
+  typedef std::tuple<typename std::decay<Args>::type...>      key_type;
+};
+
+// f with its results cached by argument.  Copies share the cache, so a
+// memoized function can be handed to map and still be asked for its hits
+// afterwards.  Calls may come from any number of threads; two threads
+// missing on the same arguments at once both call f, and the first
+// result stored is the one kept.
+template<typename F>
+class memoized {
+public:
+  typedef typename __memo_traits__<F>::result_type result_type;
+  typedef typename __memo_traits__<F>::key_type    key_type;
+
+  memoized(F f, size_t capacity)
+    : mF(std::move(f)), mCache(std::make_shared< memo_cache<key_type, result_type> >(capacity)) { }
+
+  template<typename... Args>
+  result_type operator()(Args&&... args) const {
+    key_type key(args...);
+    Maybe<result_type> cached = mCache->find(key);
+    if (cached)
+      return *cached;
+    result_type result = mF(std::forward<Args>(args)...);
+    mCache->insert(std::move(key), result);
+    return result;
+  }
+
+  size_t   size()   const { return mCache->size(); }
+  uint64_t hits()   const { return mCache->hits(); }
+  uint64_t misses() const { return mCache->misses(); }
+
+private:
+  F                                                         mF;
+  std::shared_ptr< memo_cache<key_type, result_type> >      mCache;
+};
+
+// Without a capacity the cache keeps every result; with one it keeps about
+// that many, evicting results that have not been hit for a while.
+// Example: let cost = memoize( lookupCost, 10000 ); map( cost, orders );
+template<typename F>
+inline memoized<F> memoize(F f, size_t capacity = 0) {
+  return memoized<F>(std::move(f), capacity);
+}
+
+} /* namespace fp */
+
+#endif /* FP_VARIADIC */
+
+#endif /* _FP_MEMOIZE_H_ */
@@ -0,0 +1,289 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_PARALLEL_H_
+#define _FP_PARALLEL_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Parallel operations
+///////////////////////////////////////////////////////////////////////////
+
+// Ranges smaller than this are not worth a thread
+#if !defined(FP_PARALLEL_GRAIN)
+#define FP_PARALLEL_GRAIN 1024
+#endif
+
+inline size_t concurrency() {
+  const size_t threads = std::thread::hardware_concurrency();
+  return threads > 0 ? threads : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// thread_pool
+
+// How deep in pool tasks the calling thread is, and the pool it works for
+inline size_t& __taskDepth__() {
+  static FP_THREAD_LOCAL size_t depth = 0;
+  return depth;
+}
+inline const void*& __workerOf__() {
+  static FP_THREAD_LOCAL const void* pool = nullptr;
+  return pool;
+}
+
+// Worker threads running queued tasks in turn, at most as many at once as
+// the pool was made with.  A thread waiting for the pool (waitUntil) runs
+// queued tasks meanwhile if it is not itself in the middle of one.  A task
+// that waits blocks instead, since a task it picked up could be waiting on
+// the one suspended beneath it; a blocked worker hands its turn to another
+// thread, started if none is idle, so tasks may wait on tasks queued after
+// them without running the pool dry.  The pool keeps the threads it starts.
+// Pending tasks are run before the pool goes.
+class thread_pool {
+public:
+  explicit thread_pool(size_t threads = concurrency())
+    : mStopping(false), mWaiting(0), mIdle(0), mTurns((ptrdiff_t)std::max<size_t>(threads, 1)) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (ptrdiff_t i = 0; i < mTurns; ++i)
+      spawn();
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+    }
+    mWork.notify_all();
+    // Tasks still running may start threads
+    for (size_t i = 0; ; ++i) {
+      std::thread t;
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (i == mThreads.size())
+          break;
+        t = std::move(mThreads[i]);
+      }
+      t.join();
+    }
+  }
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mTasks.push_back(std::move(task));
+      if (mWaiting > 0)
+        mChanged.notify_all();
+    }
+    mWork.notify_one();
+  }
+
+  // Runs a queued task on the calling thread; false if there was none
+  bool runOne() {
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (mTasks.empty())
+        return false;
+      task = std::move(mTasks.front());
+      mTasks.pop_front();
+    }
+    run(task);
+    return true;
+  }
+
+  // Returns once done() holds; done is checked again after every task the
+  // pool finishes
+  template<typename F>
+  void waitUntil(F done) {
+    if (done())
+      return;
+    if (__taskDepth__() == 0) {
+      while (!done()) {
+        if (runOne())
+          continue;
+        std::unique_lock<std::mutex> lock(mMutex);
+        ++mWaiting;
+        mChanged.wait(lock, [&]() { return !mTasks.empty() || done(); });
+        --mWaiting;
+      }
+      return;
+    }
+
+    const bool worker = __workerOf__() == this;
+    std::unique_lock<std::mutex> lock(mMutex);
+    ++mWaiting;
+    if (worker) {
+      ++mTurns;
+      if (mIdle < mTurns)
+        spawn();
+      mWork.notify_one();
+    }
+    mChanged.wait(lock, done);
+    if (worker)
+      --mTurns;
+    --mWaiting;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mThreads.size();
+  }
+
+private:
+  thread_pool(const thread_pool&);
+  thread_pool& operator=(const thread_pool&);
+
+  // With mMutex held
+  void spawn() {
+    ++mIdle;
+    mThreads.push_back(std::thread([this]() { work(); }));
+  }
+
+  void run(std::function<void()>& task) {
+    ++__taskDepth__();
+    task();
+    --__taskDepth__();
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mWaiting > 0)
+      mChanged.notify_all();
+  }
+
+  // Each task takes one of mTurns, so no more than the pool's size run at
+  // once however many threads it has started
+  void work() {
+    __workerOf__() = this;
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWork.wait(lock, [this]() {
+          return (mStopping && mTasks.empty()) || (!mTasks.empty() && mTurns > 0);
+        });
+        if (mTasks.empty()) {
+          --mIdle;
+          return;
+        }
+        task = std::move(mTasks.front());
+        mTasks.pop_front();
+        --mIdle;
+        --mTurns;
+      }
+      run(task);
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ++mIdle;
+        ++mTurns;
+      }
+      mWork.notify_one();
+    }
+  }
+
+  bool                                 mStopping;
+  size_t                               mWaiting;
+  ptrdiff_t                            mIdle;
+  ptrdiff_t                            mTurns;
+  std::deque< std::function<void()> >  mTasks;
+  std::vector<std::thread>             mThreads;
+  mutable std::mutex                   mMutex;
+  std::condition_variable              mWork, mChanged;
+};
+
+// The pool parallelFor and futures share, one thread per core
+inline thread_pool& sharedPool() {
+  static thread_pool pool;
+  return pool;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// parallelFor
+
+// Splits [0,n) into contiguous chunks and calls f(first, last) for each,
+// on the shared pool; the calling thread takes chunks too.  Chunks are
+// claimed in order by whichever thread gets there first, so the caller
+// only ever waits for chunks already running, and a task that starts after
+// the last chunk is claimed returns without touching f.  If f throws, the
+// chunks not yet claimed are skipped and the first exception is rethrown
+// once the running ones finish.
+template<typename F>
+inline void parallelFor(size_t n, F f, size_t grain = FP_PARALLEL_GRAIN) {
+  const size_t tasks = std::min(concurrency(), (n + grain - 1) / std::max<size_t>(grain, 1));
+  if (tasks <= 1) {
+    if (n > 0) f(size_t(0), n);
+    return;
+  }
+
+  const size_t chunkSize = (n + tasks - 1) / tasks;
+  const size_t chunks    = (n + chunkSize - 1) / chunkSize;
+  struct progress {
+    progress() : next(0), done(0) { }
+    std::atomic<size_t> next, done;
+    std::exception_ptr  error;
+    std::mutex          mutex;
+  };
+  let claimed = std::make_shared<progress>();
+  const F* body = &f;
+  let runChunks = [claimed, body, chunkSize, chunks, n]() {
+    for (size_t c; (c = claimed->next.fetch_add(1)) < chunks; ) {
+      try {
+        (*body)(c * chunkSize, std::min(n, (c + 1) * chunkSize));
+      } catch (...) {
+        {
+          std::lock_guard<std::mutex> lock(claimed->mutex);
+          if (!claimed->error)
+            claimed->error = std::current_exception();
+        }
+        // Chunks no one has claimed yet will not run; count them as done
+        const size_t unclaimed = claimed->next.exchange(chunks);
+        if (unclaimed < chunks)
+          claimed->done.fetch_add(chunks - unclaimed);
+      }
+      claimed->done.fetch_add(1);
+    }
+  };
+  thread_pool& pool = sharedPool();
+  for (size_t i = 1; i < chunks; ++i)
+    pool.submit(runChunks);
+  runChunks();
+  pool.waitUntil([&]() { return claimed->done.load() == chunks; });
+  if (claimed->error)
+    std::rethrow_exception(claimed->error);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// mapP
+
+// As map, but with the list split across threads; f must be safe to call
+// concurrently.  Requires a random access source.
+template<typename F, typename C>
+inline auto mapP(F f, const C& c) -> typename types< nonconstref_type_of(decltype(f(head(c)))) >::list {
+  typedef typename types< nonconstref_type_of(decltype(f(head(c)))) >::list result_type;
+  result_type result(c.size());
+  let src = begin(c);
+  let dst = begin(result);
+  parallelFor(c.size(), [=](size_t first, size_t last) {
+    std::transform(src + first, src + last, dst + first, f);
+  });
+  return result;
+}
+
+} /* namespace fp */
+
+#endif /* _FP_PARALLEL_H_ */
@@ -9,6 +9,7 @@
 
 #include "fp_common.h"
 #include "fp_prelude_lists.h"
+#include "fp_stream.h"
 
 namespace fp {
 
@@ -119,26 +120,27 @@ inline thunk<T> drop(size_t n, thunk<T> t) {
 ///////////////////////////////////////////////////////////////////////////
 // splitAt
 
-// Does this even make sense?
+// The first n values and the rest, each read on its own: reading the rest
+// first keeps the skipped values for the prefix
 template <typename T>
-inline pair< thunk<T>, thunk<T> > splitAt(size_t n, thunk<T> t) {
-  return make_pair( t, drop(n, t) );
+inline pair< stream<T>, stream<T> > splitAt(size_t n, thunk<T> t) {
+  return splitAt( n, stream<T>( [=]() { return just( t() ); } ) );
 }
 
 ///////////////////////////////////////////////////////////////////////////
 // span
 
 template <typename F, typename T>
-inline pair< thunk<T>, thunk<T> > span(F f, thunk<T> t) {
-  return std::make_pair( t,  dropWhile(f, t) );
+inline pair< stream<T>, stream<T> > span(F f, thunk<T> t) {
+  return span( f, stream<T>( [=]() { return just( t() ); } ) );
 }
 
 ///////////////////////////////////////////////////////////////////////////
 // break
 
 template <typename F, typename T>
-inline std::pair< thunk<T>, thunk<T> > spanNot(F f, thunk<T> t) {
-  return span( std::not1(f), t );
+inline pair< stream<T>, stream<T> > spanNot(F f, thunk<T> t) {
+  return span( [=]( const T& x ) { return !f( x ); }, t );
 }
 
 ///////////////////////////////////////////////////////////////////////////
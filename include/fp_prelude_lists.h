@@ -54,10 +54,9 @@ void mapV(F f, const C& c) {
 
 template<typename F>
 inline string map(F f, const string& s) {
-  typedef typename types<char>::list char_list;
-  char_list charList;
-   __map__(f, char_list(extent(s)), charList);
-  return move(show(charList));
+  string result(s.size(), '\0');
+  std::transform(extent(s), begin(result), f);
+  return result;
 }
 
 template<typename F>
@@ -75,6 +74,12 @@ inline C filter(F f, const C& c) {
   std::copy_if(extent(c), back(result), f);
   return move(result);
 }
+template<typename F>
+inline string filter(F f, const string& s) {
+  string result(s.size(), '\0');
+  result.resize(std::copy_if(extent(s), begin(result), f) - begin(result));
+  return result;
+}
 FP_DEFINE_CURRIED(filter, filter_);
 
 template<typename T, typename F>
@@ -660,9 +665,29 @@ inline auto enumFrom(T t0) FP_RETURNS( iterate(&succ<T>, t0) );
 
 ///////////////////////////////////////////////////////////////////////////
 // uniform
+template<typename T>
+inline typename types<T>::list __uniformN__(size_t n, T t0, T t1, math::uniform_gen& gen) {
+  enum { CHUNK = 1024 };
+  T values[CHUNK];
+  typename types<T>::list result;
+  result.reserve(n);
+  for (size_t count; n > 0; n -= count) {
+    count = n < CHUNK ? n : CHUNK;
+    math::uniformFill(values, count, t0, t1, gen);
+    result.insert(end(result), values, values + count);
+  }
+  return result;
+}
+
 template<typename T>
 inline typename types<T>::list uniformN(size_t n, T t0, T t1) {
-  return takeF(n, [=]() { return math::uniform(t0,t1); });
+  return __uniformN__(n, t0, t1, math::generator());
+}
+// Reproducible: element i is always math::uniformAt(t0, t1, seed, i)
+template<typename T>
+inline typename types<T>::list uniformN(size_t n, T t0, T t1, uint64_t seed) {
+  math::uniform_gen gen(seed);
+  return __uniformN__(n, t0, t1, gen);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -13,11 +13,9 @@
 #include <math.h>
 #undef  _USE_MATH_DEFINES
 
-#if defined(_MSC_VER)
-#include <random>
-#else
-#include <tr1/random>
-#endif
+#include <atomic>
+#include <stdint.h>
+#include <type_traits>
 
 namespace fp {
 namespace math {
@@ -137,67 +135,267 @@ inline fp_enable_if_integral(T) powerOfTwo(T t) {
 /////////////////////////////////////////////////////////////////////////
 // Random operations
 
-#if defined(_MSC_VER)
-using std::uniform_real;
-using std::uniform_int;
-using std::mt19937;
-using std::random_device;
+// All random values come from a counter-based generator: the state is just a
+// key (seed, stream) and a counter, so a stream can be split per thread or
+// per task without locks, and the i-th value of a seeded stream is the same
+// no matter how many threads were used to produce the values before it.
+
+///////////////////////////////////////////////////////////////////////////
+// philox
+
+// Counters generated together by philox::generate64.  Narrow vector units
+// lose to the plain scalar rounds, which are multiply-latency bound anyway.
+#if !defined(FP_RANDOM_LANES)
+#if defined(__AVX512F__)
+#define FP_RANDOM_LANES 8
 #else
-using std::tr1::uniform_real;
-using std::tr1::uniform_int;
-using std::tr1::mt19937;
-using std::tr1::random_device;
+#define FP_RANDOM_LANES 1
+#endif
 #endif
 
-// ///////////////////////////////////////////////////////////////////////////
-// uniform
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3")
+class philox {
+public:
+  typedef uint32_t result_type;
+
+  explicit philox(uint64_t seed = 0, uint64_t stream = 0)
+    : mCounter(0), mBlock(), mIndex(4) {
+    mKey[0] = (uint32_t)seed;   mKey[1] = (uint32_t)(seed >> 32);
+    mStream[0] = (uint32_t)stream; mStream[1] = (uint32_t)(stream >> 32);
+  }
+
+  static result_type min() { return 0; }
+  static result_type max() { return 0xFFFFFFFFu; }
+
+  result_type operator()() {
+    if (mIndex == 4) {
+      block(mCounter++, mBlock);
+      mIndex = 0;
+    }
+    return mBlock[mIndex++];
+  }
+
+  // One 64-bit draw; the i-th draw of a stream is always block i/2, so
+  // values are positioned independently of how they are consumed.
+  uint64_t next64() {
+    if (mIndex & 1) ++mIndex;
+    const uint64_t lo = (*this)();
+    return lo | ((uint64_t)(*this)() << 32);
+  }
+
+  // Next n 64-bit draws, the same values n calls to next64() would give.
+  // Whole blocks are computed LANES counters at a time with the state in
+  // lane arrays, so the rounds vectorize where the target has a widening
+  // 32-bit multiply on wide vectors.
+  void generate64(uint64_t* out, size_t n) {
+    // Drain the current block first, as next64 would
+    while (n > 0 && mIndex < 4) {
+      *out++ = next64();
+      --n;
+    }
+    enum { LANES = FP_RANDOM_LANES };
+    while (n >= 2 * LANES) {
+      uint32_t c0[LANES], c1[LANES], c2[LANES], c3[LANES];
+      for (int l = 0; l < LANES; ++l) {
+        const uint64_t counter = mCounter + l;
+        c0[l] = (uint32_t)counter; c1[l] = (uint32_t)(counter >> 32);
+        c2[l] = mStream[0];        c3[l] = mStream[1];
+      }
+      uint32_t k0 = mKey[0], k1 = mKey[1];
+      for (int round = 0; round < 10; ++round) {
+        for (int l = 0; l < LANES; ++l) {
+          const uint64_t p0 = (uint64_t)0xD2511F53u * c0[l];
+          const uint64_t p1 = (uint64_t)0xCD9E8D57u * c2[l];
+          c0[l] = (uint32_t)(p1 >> 32) ^ c1[l] ^ k0;
+          c1[l] = (uint32_t)p1;
+          c2[l] = (uint32_t)(p0 >> 32) ^ c3[l] ^ k1;
+          c3[l] = (uint32_t)p0;
+        }
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+      }
+      for (int l = 0; l < LANES; ++l) {
+        out[2*l]     = c0[l] | ((uint64_t)c1[l] << 32);
+        out[2*l + 1] = c2[l] | ((uint64_t)c3[l] << 32);
+      }
+      mCounter += LANES;
+      out += 2 * LANES;
+      n   -= 2 * LANES;
+    }
+    for (; n > 0; --n)
+      *out++ = next64();
+  }
+
+  // Position the stream at its n-th 64-bit draw, in O(1)
+  void seek(uint64_t n) {
+    mCounter = n / 2;
+    mIndex   = 4;
+    if (n % 2) {
+      block(mCounter++, mBlock);
+      mIndex = 2;
+    }
+  }
+
+  // Independent generator with the same seed
+  philox split(uint64_t stream) const {
+    return philox(seed(), stream);
+  }
+
+  uint64_t seed()   const { return mKey[0]    | ((uint64_t)mKey[1]    << 32); }
+  uint64_t stream() const { return mStream[0] | ((uint64_t)mStream[1] << 32); }
+
+private:
+  static inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+    const uint64_t p = (uint64_t)a * b;
+    hi = (uint32_t)(p >> 32);
+    lo = (uint32_t)p;
+  }
+
+  void block(uint64_t counter, uint32_t (&out)[4]) const {
+    uint32_t c[4] = { (uint32_t)counter, (uint32_t)(counter >> 32), mStream[0], mStream[1] };
+    uint32_t k[2] = { mKey[0], mKey[1] };
+    for (int round = 0; round < 10; ++round) {
+      uint32_t hi0, lo0, hi1, lo1;
+      mulhilo(0xD2511F53u, c[0], hi0, lo0);
+      mulhilo(0xCD9E8D57u, c[2], hi1, lo1);
+      c[0] = hi1 ^ c[1] ^ k[0];
+      c[1] = lo1;
+      c[2] = hi0 ^ c[3] ^ k[1];
+      c[3] = lo0;
+      k[0] += 0x9E3779B9u;
+      k[1] += 0xBB67AE85u;
+    }
+    out[0] = c[0]; out[1] = c[1]; out[2] = c[2]; out[3] = c[3];
+  }
+
+  uint32_t mKey[2];
+  uint32_t mStream[2];
+  uint64_t mCounter;
+  uint32_t mBlock[4];
+  size_t   mIndex;
+};
 
-#if !defined(__MINGW32__)
+typedef philox uniform_gen;
 
-typedef mt19937 uniform_gen;
+///////////////////////////////////////////////////////////////////////////
+// seed
 
+inline std::atomic<uint64_t>& globalSeed() {
+  static std::atomic<uint64_t> s(0x853C49E6748FEA9BULL);
+  return s;
+}
+inline std::atomic<uint64_t>& globalStream() {
+  static std::atomic<uint64_t> s(0);
+  return s;
+}
+inline std::atomic<uint64_t>& globalGeneration() {
+  static std::atomic<uint64_t> s(1);
+  return s;
+}
+
+// Reseeds every generator created afterwards, including the per-thread ones
+inline void seed(uint64_t s) {
+  globalSeed()   = s;
+  globalStream() = 0;
+  ++globalGeneration();
+}
+
+inline uniform_gen newGenerator() {
+  return uniform_gen(globalSeed(), globalStream()++);
+}
+
+// Per-thread generator behind uniform(t0,t1)
+inline uniform_gen& generator() {
+  static FP_THREAD_LOCAL uniform_gen gen;
+  static FP_THREAD_LOCAL uint64_t    generation = 0;
+  if (generation != globalGeneration()) {
+    generation = globalGeneration();
+    gen = newGenerator();
+  }
+  return gen;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// fromBits
+
+// Maps 64 random bits into [t0,t1) for floats and [t0,t1] for integers
+// without branches or rejection loops, so each value costs exactly one draw.
 template<typename T>
 inline typename std::enable_if< std::is_floating_point<T>::value, T>::type
-  uniform(T t0, T t1) {
-    static uniform_gen generator;
-    return uniform_real<T>(t0, t1)(generator);
+  fromBits(uint64_t bits, T t0, T t1) {
+    const double u = (double)(bits >> 11) * (1.0 / 9007199254740992.0);
+    return (T)(t0 + (t1 - t0) * u);
+}
+inline float fromBits(uint64_t bits, float t0, float t1) {
+  const float u = (float)(uint32_t)(bits >> 40) * (1.0f / 16777216.0f);
+  return t0 + (t1 - t0) * u;
 }
 
 template<typename T>
 inline typename std::enable_if< !std::is_floating_point<T>::value, T>::type
-  uniform(T t0, T t1) {
-    static uniform_gen generator;
-    return uniform_int<T>(t0, t1)(generator);
+  fromBits(uint64_t bits, T t0, T t1) {
+    const uint64_t range = (uint64_t)((uint64_t)t1 - (uint64_t)t0) + 1;
+#if defined(__SIZEOF_INT128__)
+    const uint64_t offset = (uint64_t)(((unsigned __int128)bits * range) >> 64);
+#else
+    const uint64_t aLo = (uint32_t)bits, aHi = bits >> 32;
+    const uint64_t bLo = (uint32_t)range, bHi = range >> 32;
+    const uint64_t mid = aHi * bLo + ((aLo * bLo) >> 32);
+    const uint64_t offset = aHi * bHi + (mid >> 32) + ((aLo * bHi + (uint32_t)mid) >> 32);
+#endif
+    return (T)((uint64_t)t0 + (range ? offset : bits));
 }
 
-template<typename T>
-struct uniform_ {
-  uniform_(T t0, T t1, unsigned long long seed)
-    : mUniform(t0, t1), mGenerator(seed) { }
-  uniform_(T t0, T t1)
-    : mUniform(t0, t1), mGenerator(random_device()()) { }
-
-  T operator()() const { return mUniform(mGenerator); }
+///////////////////////////////////////////////////////////////////////////
+// uniform
 
-  uniform_real<T> mUniform;
-  mutable uniform_gen mGenerator;
-};
+template<typename T>
+inline T uniform(T t0, T t1) {
+  return fromBits(generator().next64(), t0, t1);
+}
 
-#else
+// Writes n values to first, which may be uninitialized storage
+template<typename T>
+inline T* uniformFill(T* first, size_t n, T t0, T t1, uniform_gen& gen) {
+  enum { CHUNK = 256 };
+  uint64_t bits[CHUNK];
+  while (n > 0) {
+    const size_t count = n < CHUNK ? n : CHUNK;
+    gen.generate64(bits, count);
+    for (size_t i = 0; i < count; ++i)
+      first[i] = fromBits(bits[i], t0, t1);
+    first += count;
+    n     -= count;
+  }
+  return first;
+}
 
+// i-th value of the seeded stream; independent of evaluation order
 template<typename T>
-inline T uniform(T t0, T t1) {
-  return (T)(t0 + static_cast<double>(rand())/((unsigned long long)RAND_MAX+1) * (t1 - t0));
+inline T uniformAt(T t0, T t1, uint64_t seed, uint64_t i, uint64_t stream = 0) {
+  uniform_gen gen(seed, stream);
+  gen.seek(i);
+  return fromBits(gen.next64(), t0, t1);
 }
+
 template<typename T>
 struct uniform_ {
-  uniform_(T t0_, T t1_) : t0(t0_), t1(t1_) { }
-  T operator()() { return uniform<T>(t0,t1); }
+  uniform_(T t0_, T t1_, uint64_t seed, uint64_t stream = 0)
+    : t0(t0_), t1(t1_), mGenerator(seed, stream) { }
+  uniform_(T t0_, T t1_)
+    : t0(t0_), t1(t1_), mGenerator(newGenerator()) { }
+
+  T operator()() const { return fromBits(mGenerator.next64(), t0, t1); }
+
+  // Generator for the next independent stream of the same seed
+  uniform_ split(uint64_t stream) const {
+    return uniform_(t0, t1, mGenerator.seed(), stream);
+  }
+
   T t0, t1;
+  mutable uniform_gen mGenerator;
 };
 
-#endif
-
 } /* namespace math */
 } /* namespace fp   */
 
@@ -10,11 +10,19 @@
 #include "fp_defines.h"
 #include "fp_prelude.h"
 #include "fp_prelude_lists.h"
+#include "fp_format.h"
+#include "fp_string_list.h"
+#include "fp_rope.h"
 
+#include <algorithm>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 
+#if FP_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace fp {
 
 ///////////////////////////////////////////////////////////////////////////
@@ -37,33 +45,225 @@ inline typename types<T>::list split(const T& s, char delim) {
   return split_helper(s, delim, elems);
 };
 
+inline types<string>::list split(const string& s, char delim) {
+  types<string>::list elems;
+  const char* first = s.data();
+  const char* last  = first + s.size();
+  while (first != last) {
+    const char* next = (const char*)memchr(first, delim, last - first);
+    if (!next) next = last;
+    elems.push_back(string(first, next));
+    first = next == last ? last : next + 1;
+  }
+  return elems;
+}
+
+// As split, in a string_list: the pieces share one buffer
+inline string_list packedSplit(const string_ref& s, char delim) {
+  string_list elems;
+  elems.reserve(0, s.size());
+  const char* first = s.begin();
+  const char* last  = s.end();
+  while (first != last) {
+    const char* next = (const char*)memchr(first, delim, last - first);
+    if (!next) next = last;
+    elems.push_back(string_ref(first, next));
+    first = next == last ? last : next + 1;
+  }
+  return elems;
+}
+
 template<typename C>
 string concat(const C& c, const char* infix = " ", const char* prefix = "", const char* suffix = "") {
   if (length(c) == 0)
     return "";
-  
-  std::stringstream ss;
-  ss << prefix;
+
+  string s;
+  s.reserve(showSize(c));
+  s.append(prefix);
   let it = begin(c);
   if (it != end(c)) {
     while (true) {
-      ss << show(*it);
+      showTo(s, *it);
       if (++it == end(c)) break;
-      ss << infix;
+      s.append(infix);
     }
   }
-  ss << suffix;
+  s.append(suffix);
 
-  return ss.str();
+  return s;
 }
 
 inline bool istrue(bool b) { return b; }
 
+///////////////////////////////////////////////////////////////////////////
+// Character tables
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+// char_map
+
+// Byte-to-byte function as a 256 entry table.  Tables that only shift one
+// contiguous range of bytes (ASCII case folding) are mapped 16 bytes at a
+// time with SSE2.
+struct char_map {
+  char_map() : lo(1), hi(0), delta(0) {
+    for (int c = 0; c < 256; ++c) table[c] = (unsigned char)c;
+  }
+  template<typename F>
+  explicit char_map(F f) : lo(1), hi(0), delta(0) {
+    for (int c = 0; c < 256; ++c) table[c] = (unsigned char)f((char)c);
+    detectRange();
+  }
+  char_map(unsigned char lo_, unsigned char hi_, int delta_) : lo(lo_), hi(hi_), delta(delta_) {
+    for (int c = 0; c < 256; ++c)
+      table[c] = (unsigned char)(c >= lo && c <= hi ? c + delta : c);
+  }
+
+  inline char operator()(char c) const { return (char)table[(unsigned char)c]; }
+  inline bool isRangeShift() const { return lo <= hi; }
+
+  unsigned char table[256];
+  unsigned char lo, hi;
+  int delta;
+
+private:
+  void detectRange() {
+    int first = 256, last = -1;
+    for (int c = 0; c < 256; ++c) {
+      if (table[c] != c) { first = std::min(first, c); last = c; }
+    }
+    if (last < 0) return;
+    const int d = table[first] - first;
+    for (int c = first; c <= last; ++c) {
+      if (table[c] != (unsigned char)(c + d)) return;
+    }
+    lo = (unsigned char)first; hi = (unsigned char)last; delta = d;
+  }
+};
+
+template<typename F>
+inline char_map charMap(F f) { return char_map(f); }
+
+inline const char_map& toUpper() { static const char_map m('a', 'z', 'A' - 'a'); return m; }
+inline const char_map& toLower() { static const char_map m('A', 'Z', 'a' - 'A'); return m; }
+
+///////////////////////////////////////////////////////////////////////////
+// char_class
+
+// Byte predicate as a 256 entry table; a single contiguous range of bytes
+// (digits, one case of letters) is tested 16 bytes at a time with SSE2.
+struct char_class {
+  char_class() : lo(1), hi(0) {
+    std::fill(table, table + 256, (unsigned char)0);
+  }
+  template<typename F>
+  explicit char_class(F f) : lo(1), hi(0) {
+    for (int c = 0; c < 256; ++c) table[c] = f((char)c) ? 1 : 0;
+    detectRange();
+  }
+  char_class(unsigned char lo_, unsigned char hi_) : lo(lo_), hi(hi_) {
+    for (int c = 0; c < 256; ++c) table[c] = (c >= lo && c <= hi) ? 1 : 0;
+  }
+
+  inline bool operator()(char c) const { return table[(unsigned char)c] != 0; }
+  inline bool isRange() const { return lo <= hi; }
+
+  unsigned char table[256];
+  unsigned char lo, hi;
+
+private:
+  void detectRange() {
+    int first = -1, last = -1;
+    for (int c = 0; c < 256; ++c) {
+      if (table[c]) { if (first < 0) first = c; last = c; }
+    }
+    if (first < 0) return;
+    for (int c = first; c <= last; ++c) {
+      if (!table[c]) return;
+    }
+    lo = (unsigned char)first; hi = (unsigned char)last;
+  }
+};
+
+template<typename F>
+inline char_class charClass(F f) { return char_class(f); }
+
+inline const char_class& isDigit() { static const char_class c('0', '9'); return c; }
+inline const char_class& isUpper() { static const char_class c('A', 'Z'); return c; }
+inline const char_class& isLower() { static const char_class c('a', 'z'); return c; }
+
+#if FP_SSE2
+// Bytes of x within [lo,hi] as 0xFF, others as 0x00
+inline __m128i __inRange__(__m128i x, unsigned char lo, unsigned char hi) {
+  const __m128i limit = _mm_set1_epi8((char)(hi - lo));
+  const __m128i y     = _mm_sub_epi8(x, _mm_set1_epi8((char)lo));
+  return _mm_cmpeq_epi8(_mm_max_epu8(y, limit), limit);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// map
+
+inline string map(const char_map& m, const string& s) {
+  string result(s.size(), '\0');
+  const char* in  = s.data();
+  char*       out = &result[0];
+  size_t i = 0, n = s.size();
+#if FP_SSE2
+  if (m.isRangeShift()) {
+    const __m128i delta = _mm_set1_epi8((char)m.delta);
+    for (; i + 16 <= n; i += 16) {
+      const __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+      const __m128i shift = _mm_and_si128(__inRange__(x, m.lo, m.hi), delta);
+      _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi8(x, shift));
+    }
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] = m(in[i]);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// filter
+
+inline string filter(const char_class& p, const string& s) {
+  string result(s.size(), '\0');
+  const char* in  = s.data();
+  char*       out = &result[0];
+  size_t i = 0, j = 0, n = s.size();
+#if FP_SSE2
+  if (p.isRange()) {
+    for (; i + 16 <= n; i += 16) {
+      const __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+      const int mask = _mm_movemask_epi8(__inRange__(x, p.lo, p.hi));
+      if (mask == 0xFFFF) {
+        _mm_storeu_si128((__m128i*)(out + j), x);
+        j += 16;
+      } else if (mask != 0) {
+        for (int k = 0; k < 16; ++k) {
+          out[j] = in[i + k];
+          j += (mask >> k) & 1;
+        }
+      }
+    }
+  }
+#endif
+  // Branch-free: always write, only advance past kept bytes
+  for (; i < n; ++i) {
+    out[j] = in[i];
+    j += p.table[(unsigned char)in[i]];
+  }
+  result.resize(j);
+  return result;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // lines
 
 template<typename T>
-inline typename types<T>::list lines(const T& s) {
+inline auto lines(const T& s) -> decltype(split(s, '\n')) {
   return split(s, '\n');
 }
 inline types<string>::list lines(std::ifstream& ifs) {
@@ -74,6 +274,19 @@ inline types<string>::list lines(std::ifstream& ifs) {
   return ifsLines;
 }
 
+// The lines in a string_list, for many short lines
+// Example: fp::sort( fp::packedLines( text ) )
+inline string_list packedLines(const string_ref& s) {
+  return packedSplit(s, '\n');
+}
+inline string_list packedLines(std::ifstream& ifs) {
+  string_list ifsLines;
+  string line;
+  while (getline(ifs, line))
+    ifsLines.push_back(line);
+  return ifsLines;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // unlines
 
@@ -85,10 +298,14 @@ auto unlines(const C& elems) -> value_type_of(C) {
 ///////////////////////////////////////////////////////////////////////////
 // words
 template<typename T>
-inline typename types<T>::list words(const T& s) {
+inline auto words(const T& s) -> decltype(split(s, ' ')) {
   return split(s, ' ');
 }
 
+inline string_list packedWords(const string_ref& s) {
+  return packedSplit(s, ' ');
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // unwords
 
@@ -101,9 +318,9 @@ auto unwords(const T& elems) -> decltype(concat(elems, ' ')) {
 // show
 template<typename T>
 inline fp_enable_if_not_container(T,string) show(const T& t) {
-  std::stringstream ss;
-  ss << t;
-  return ss.str();
+  string s;
+  showTo(s, t);
+  return s;
 }
 
 inline string show(const types<char>::list& c) {
@@ -114,36 +331,47 @@ inline string show(const string& s) {
   return s;
 }
 
+inline string show(const rope& r) {
+  return r.str();
+}
+
 template<typename C>
 inline fp_enable_if_container(C,string) show(const C& c) {
-
-  typedef value_type_of(C) T;
-  const bool is_nonstring_container = is_container<T>::value && !std::is_same<string,T>::value;
-  const char* infix  = is_nonstring_container ? ",\n" : ", ";
-  const char* prefix = is_nonstring_container ? "["   : "[";
-  const char* suffix = is_nonstring_container ? "]\n" : "]";
-
-  return concat( c, infix, prefix, suffix );
+  string s;
+  s.reserve(showSize(c));
+  showTo(s, c);
+  return s;
 }
 
 
 ///////////////////////////////////////////////////////////////////////////
 // print
 
+// All of these go through stdoutBuffer(); see output_buffer and flush().
+
 inline void putStr(const string& s) {
-  std::cout << s;
+  stdoutBuffer().write(s);
 }
 
 inline void putStr(string&& s) {
-  std::cout << s;
+  stdoutBuffer().write(s);
+}
+
+inline void putStr(const rope& r) {
+  r.forEachChunk([](const string_ref& c) { stdoutBuffer().write(c.data(), c.size()); });
 }
 
 inline void putStrLen(const string& s) {
-  std::cout << s << std::endl;
+  stdoutBuffer().write(s, true);
 }
 
 inline void putStrLen(string&& s) {
-  std::cout << s << std::endl;
+  stdoutBuffer().write(s, true);
+}
+
+inline void putStrLen(const rope& r) {
+  putStr(r);
+  stdoutBuffer().write("", 0, true);
 }
 
 template<typename T>
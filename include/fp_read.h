@@ -0,0 +1,351 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_READ_H_
+#define _FP_READ_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+#include "fp_string_ref.h"
+
+#include <errno.h>
+#include <float.h>
+#include <istream>
+#include <limits>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Parsing
+///////////////////////////////////////////////////////////////////////////
+
+inline bool __isSpace__(char c) {
+  return c == ' ' || (unsigned char)(c - '\t') <= (unsigned char)('\r' - '\t');
+}
+
+inline uint64_t __load8__(const char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline unsigned __ctz64__(uint64_t v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long i;
+  _BitScanForward64(&i, v);
+  return (unsigned)i;
+#elif defined(__GNUC__)
+  return (unsigned)__builtin_ctzll(v);
+#else
+  unsigned i = 0;
+  for (; !(v & 1); v >>= 1) ++i;
+  return i;
+#endif
+}
+
+// Length of the run of '0'..'9' starting at p, eight chars at a time
+inline size_t __digitRun__(const char* p, const char* last) {
+  const char* first = p;
+#if FP_LITTLE_ENDIAN
+  const uint64_t ones = 0x0101010101010101ULL;
+  for (; last - p >= 8; p += 8) {
+    // Top bit of each byte is set where the byte is not a digit; the low
+    // seven bits are handled alone so no carry crosses into the next byte.
+    const uint64_t v  = __load8__(p);
+    const uint64_t lo = v & (0x7F * ones);
+    const uint64_t nondigit = (v | (lo + 0x46 * ones) | ~(lo + 0x50 * ones)) & (0x80 * ones);
+    if (nondigit)
+      return (p - first) + (__ctz64__(nondigit) >> 3);
+  }
+#endif
+  while (p != last && (unsigned char)(*p - '0') < 10) ++p;
+  return p - first;
+}
+
+// Value of exactly eight digit chars
+inline uint32_t __parse8__(uint64_t v) {
+  v -= 0x3030303030303030ULL;
+  v = (v * 10) + (v >> 8);
+  v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+       (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+  return (uint32_t)v;
+}
+
+// Value of the n digits at p; false if it does not fit in 64 bits
+inline bool __parseDigits__(const char* p, size_t n, uint64_t& v) {
+  for (; n > 0 && *p == '0'; --n) ++p;
+  if (n > 20)
+    return false;
+
+  // Any 19 digits fit; only the 20th can overflow
+  const size_t safe = n < 19 ? n : 19;
+  size_t i = 0;
+  v = 0;
+#if FP_LITTLE_ENDIAN
+  for (; i + 8 <= safe; i += 8)
+    v = v * 100000000 + __parse8__(__load8__(p + i));
+#endif
+  for (; i < safe; ++i)
+    v = v * 10 + (unsigned)(p[i] - '0');
+  if (n == 20) {
+    const unsigned d = (unsigned)(p[19] - '0');
+    if (v > (UINT64_MAX - d) / 10)
+      return false;
+    v = v * 10 + d;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Integers
+
+template<typename T>
+inline bool __readInteger__(const char* p, const char* last, T& t) {
+  bool negative = false;
+  if (p != last && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  const size_t n = __digitRun__(p, last);
+  uint64_t v;
+  if (n == 0 || p + n != last || !__parseDigits__(p, n, v))
+    return false;
+
+  if (!negative) {
+    if (v > (uint64_t)std::numeric_limits<T>::max())
+      return false;
+    t = (T)v;
+  } else if (v == 0) {
+    t = 0;
+  } else {
+    if (!std::is_signed<T>::value || v - 1 > (uint64_t)std::numeric_limits<T>::max())
+      return false;
+    t = (T)(-(T)(v - 1) - 1);
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Floats
+
+// Decimals with few enough digits and a small exponent are one exact
+// multiply or divide away from the correctly rounded value (Clinger's fast
+// path); everything else goes through the C library.
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+#define FP_READ_FAST_FLOAT 0
+#else
+#define FP_READ_FAST_FLOAT 1
+#endif
+
+inline bool __fastFloat__(uint64_t m, int e, double& t) {
+  static const double pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  if (!FP_READ_FAST_FLOAT || m > (1ULL << 53) || e < -22 || e > 22)
+    return false;
+  t = e < 0 ? (double)m / pow10[-e] : (double)m * pow10[e];
+  return true;
+}
+inline bool __fastFloat__(uint64_t m, int e, float& t) {
+  static const float pow10[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+  };
+  if (!FP_READ_FAST_FLOAT || m > (1ULL << 24) || e < -10 || e > 10)
+    return false;
+  t = e < 0 ? (float)m / pow10[-e] : (float)m * pow10[e];
+  return true;
+}
+inline bool __fastFloat__(uint64_t, int, long double&) {
+  return false;
+}
+
+inline void __strtof__(const char* s, char** end, double& t)      { t = strtod(s, end); }
+inline void __strtof__(const char* s, char** end, float& t)       { t = strtof(s, end); }
+inline void __strtof__(const char* s, char** end, long double& t) { t = strtold(s, end); }
+
+template<typename T>
+inline bool __readFloatSlow__(const char* first, const char* last, T& t) {
+  const size_t n = last - first;
+  char buf[128];
+  string big;
+  char* s = buf;
+  if (n >= sizeof(buf)) {
+    big.assign(first, last);
+    s = &big[0];
+  } else {
+    memcpy(buf, first, n);
+    buf[n] = '\0';
+  }
+  char* end = nullptr;
+  errno = 0;
+  __strtof__(s, &end, t);
+  // Too large for T: strtod gives infinity, which is no reading of s
+  if (errno == ERANGE && (t > std::numeric_limits<T>::max() || t < -std::numeric_limits<T>::max()))
+    return false;
+  return n > 0 && end == s + n;
+}
+
+template<typename T>
+inline bool __readFloat__(const char* first, const char* last, T& t) {
+  const char* p = first;
+  bool negative = false;
+  if (p != last && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  const char*  intFirst   = p;
+  const size_t intDigits  = __digitRun__(p, last);
+  p += intDigits;
+  const char*  fracFirst  = p;
+  size_t       fracDigits = 0;
+  if (p != last && *p == '.') {
+    fracFirst  = ++p;
+    fracDigits = __digitRun__(p, last);
+    p += fracDigits;
+  }
+  // inf, nan and friends
+  if (intDigits + fracDigits == 0)
+    return __readFloatSlow__(first, last, t);
+
+  int e = 0;
+  if (p != last && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negativeExp = false;
+    if (q != last && (*q == '-' || *q == '+'))
+      negativeExp = *q++ == '-';
+    const size_t expDigits = __digitRun__(q, last);
+    if (expDigits == 0 || q + expDigits != last)
+      return false;
+    if (expDigits > 4)
+      return __readFloatSlow__(first, last, t);
+    for (size_t i = 0; i < expDigits; ++i)
+      e = e * 10 + (q[i] - '0');
+    if (negativeExp) e = -e;
+    p = last;
+  }
+  if (p != last)
+    return false;
+  if (intDigits + fracDigits > 19)
+    return __readFloatSlow__(first, last, t);
+
+  static const uint64_t scale[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+    1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+  };
+  uint64_t m = 0, frac = 0;
+  __parseDigits__(intFirst,  intDigits,  m);
+  __parseDigits__(fracFirst, fracDigits, frac);
+  m = m * scale[fracDigits] + frac;
+  e -= (int)fracDigits;
+
+  if (!__fastFloat__(m, e, t))
+    return __readFloatSlow__(first, last, t);
+  if (negative) t = -t;
+  return true;
+}
+
+template<typename T>
+inline bool __read__(const char* first, const char* last, T& t, std::false_type) {
+  return __readInteger__(first, last, t);
+}
+template<typename T>
+inline bool __read__(const char* first, const char* last, T& t, std::true_type) {
+  return __readFloat__(first, last, t);
+}
+template<typename T>
+inline bool __read__(const char* first, const char* last, T& t) {
+  static_assert(std::is_arithmetic<T>::value, "read<T> requires a number type");
+  return __read__(first, last, t, std::is_floating_point<T>());
+}
+
+// Appends every whitespace-separated value in [p,last) to result
+template<typename T>
+inline bool __readAll__(const char* p, const char* last, typename types<T>::list& result) {
+  for (;;) {
+    while (p != last && __isSpace__(*p)) ++p;
+    if (p == last)
+      return true;
+    const char* first = p;
+    while (p != last && !__isSpace__(*p)) ++p;
+    T t;
+    if (!__read__(first, p, t))
+      return false;
+    result.push_back(t);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// read
+
+// The value of s, ignoring surrounding whitespace, or Nothing if s is not a
+// number of type T that fits.  Accepts a string, a string_ref (e.g. from
+// words or lines over a string_ref) or a C string.  A float too large for
+// T is Nothing; one too small rounds to zero.
+// Example: read<int>(" -42 ") == just(-42)
+template<typename T>
+inline Maybe<T> read(const string_ref& s) {
+  const char* first = s.begin();
+  const char* last  = s.end();
+  while (first != last && __isSpace__(*first))    ++first;
+  while (last != first && __isSpace__(last[-1])) --last;
+  T t;
+  return __read__(first, last, t) ? Maybe<T>(t) : Maybe<T>();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// readAll
+
+// All whitespace-separated values in s, or Nothing if any is not a T
+template<typename T>
+inline Maybe<typename types<T>::list> readAll(const string_ref& s) {
+  typename types<T>::list result;
+  if (!__readAll__<T>(s.begin(), s.end(), result))
+    return Nothing();
+  return Maybe<typename types<T>::list>(std::move(result));
+}
+
+// As above, reading the stream a block at a time
+template<typename T>
+inline Maybe<typename types<T>::list> readAll(std::istream& is, size_t blockSize = 1 << 20) {
+  typename types<T>::list result;
+  string buffer;
+  size_t carry = 0;
+  for (;;) {
+    buffer.resize(carry + blockSize);
+    is.read(&buffer[carry], blockSize);
+    const size_t n = (size_t)is.gcount();
+    const char* first = buffer.data();
+    const char* last  = first + carry + n;
+    if (n == 0)
+      break;
+
+    // Hold back a token that may continue in the next block
+    const char* split = last;
+    while (split != first && !__isSpace__(split[-1])) --split;
+    if (!__readAll__<T>(first, split, result))
+      return Nothing();
+    carry = last - split;
+    memmove(&buffer[0], split, carry);
+  }
+  if (!__readAll__<T>(buffer.data(), buffer.data() + carry, result))
+    return Nothing();
+  return Maybe<typename types<T>::list>(std::move(result));
+}
+
+} /* namespace fp */
+
+#endif /* _FP_READ_H_ */
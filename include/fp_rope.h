@@ -0,0 +1,249 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_ROPE_H_
+#define _FP_ROPE_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_string_ref.h"
+
+#include <algorithm>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+
+namespace fp {
+
+// Leaves up to this size are merged when joined, so building a rope a
+// char or a word at a time does not leave a leaf per piece
+#if !defined(FP_ROPE_LEAF_SIZE)
+#define FP_ROPE_LEAF_SIZE 128
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// rope
+///////////////////////////////////////////////////////////////////////////
+
+// An immutable string kept as a balanced tree of shared chunks.  Joining
+// two ropes, cons and append are O(log n) and share both sides; substr is
+// O(log n) and shares the chars it views.  str() flattens the chunks into
+// one string, once, when a plain string is finally needed; show, putStr
+// and concat take ropes as they are.
+// Example: fp::putStr( fp::cons( '0', code ) )
+class rope {
+public:
+  typedef char   value_type;
+  typedef size_t size_type;
+
+  rope() { }
+  // Explicit, so a literal or string still picks the string overloads of
+  // putStr, cons and the rest
+  explicit rope(const char* s)        { *this = rope(string(s)); }
+  explicit rope(const string_ref& s)  { *this = rope(s.str()); }
+  explicit rope(string s) {
+    const size_t n = s.size();
+    if (n > 0)
+      mRoot = leaf(std::make_shared<const string>(std::move(s)), 0, n);
+  }
+  rope(size_t n, char c)              { *this = rope(string(n, c)); }
+
+  size_t size()   const { return mRoot ? mRoot->size : 0; }
+  size_t length() const { return size(); }
+  bool   empty()  const { return !mRoot; }
+
+  char operator[](size_t i) const {
+    const node* n = mRoot.get();
+    while (n->left) {
+      if (i < n->left->size) {
+        n = n->left.get();
+      } else {
+        i -= n->left->size;
+        n = n->right.get();
+      }
+    }
+    return (*n->text)[n->offset + i];
+  }
+
+  rope substr(size_t pos, size_t n = string::npos) const {
+    if (pos > size())
+      throw std::out_of_range("rope::substr");
+    return rope(slice(mRoot, pos, std::min(n, size() - pos)));
+  }
+
+  // Calls f with each chunk of chars in order
+  template<typename F>
+  void forEachChunk(F f) const {
+    if (!mRoot)
+      return;
+    const node* stack[96];
+    size_t depth = 0;
+    stack[depth++] = mRoot.get();
+    while (depth > 0) {
+      const node* n = stack[--depth];
+      if (n->left) {
+        stack[depth++] = n->right.get();
+        stack[depth++] = n->left.get();
+      } else {
+        f(string_ref(n->text->data() + n->offset, n->size));
+      }
+    }
+  }
+
+  // The chars as one string
+  string str() const {
+    string s;
+    s.reserve(size());
+    forEachChunk([&](const string_ref& c) { s.append(c.data(), c.size()); });
+    return s;
+  }
+
+  // The same chars in a single chunk
+  rope flatten() const {
+    return mRoot && mRoot->left ? rope(str()) : *this;
+  }
+
+private:
+  friend rope concat(const rope&, const rope&);
+
+  struct node;
+  typedef std::shared_ptr<const node> node_ptr;
+
+  // A leaf views size chars of text from offset; an inner node joins left
+  // and right, whose heights differ by at most one
+  struct node {
+    node_ptr                      left, right;
+    std::shared_ptr<const string> text;
+    size_t                        offset;
+    size_t                        size;
+    unsigned                      height;
+  };
+
+  explicit rope(node_ptr root) : mRoot(std::move(root)) { }
+
+  static node_ptr leaf(std::shared_ptr<const string> text, size_t offset, size_t size) {
+    let n = std::make_shared<node>();
+    n->text   = std::move(text);
+    n->offset = offset;
+    n->size   = size;
+    n->height = 0;
+    return n;
+  }
+
+  static node_ptr inner(node_ptr l, node_ptr r) {
+    let n = std::make_shared<node>();
+    n->size   = l->size + r->size;
+    n->height = std::max(l->height, r->height) + 1;
+    n->left   = std::move(l);
+    n->right  = std::move(r);
+    n->offset = 0;
+    return n;
+  }
+
+  // Joins two balanced trees whose heights differ by at most two
+  static node_ptr balance(const node_ptr& l, const node_ptr& r) {
+    if (l->height > r->height + 1) {
+      if (l->left->height >= l->right->height)
+        return inner(l->left, inner(l->right, r));
+      return inner(inner(l->left, l->right->left), inner(l->right->right, r));
+    }
+    if (r->height > l->height + 1) {
+      if (r->right->height >= r->left->height)
+        return inner(inner(l, r->left), r->right);
+      return inner(inner(l, r->left->left), inner(r->left->right, r->right));
+    }
+    return inner(l, r);
+  }
+
+  // Descends the taller tree's inner edge to a subtree of the other's
+  // height, so the cost is the difference in heights
+  static node_ptr join(const node_ptr& a, const node_ptr& b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (!a->left && !b->left && a->size + b->size <= FP_ROPE_LEAF_SIZE) {
+      string s;
+      s.reserve(a->size + b->size);
+      s.append(a->text->data() + a->offset, a->size);
+      s.append(b->text->data() + b->offset, b->size);
+      return leaf(std::make_shared<const string>(std::move(s)), 0, a->size + b->size);
+    }
+    if (a->height > b->height + 1)
+      return balance(a->left, join(a->right, b));
+    if (b->height > a->height + 1)
+      return balance(join(a, b->left), b->right);
+    return inner(a, b);
+  }
+
+  static node_ptr slice(const node_ptr& n, size_t pos, size_t count) {
+    if (count == 0)
+      return node_ptr();
+    if (pos == 0 && count == n->size)
+      return n;
+    if (!n->left)
+      return leaf(n->text, n->offset + pos, count);
+    const size_t split = n->left->size;
+    if (pos + count <= split)
+      return slice(n->left, pos, count);
+    if (pos >= split)
+      return slice(n->right, pos - split, count);
+    return join(slice(n->left, pos, split - pos), slice(n->right, 0, pos + count - split));
+  }
+
+  node_ptr mRoot;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// concat
+
+inline rope concat(const rope& a, const rope& b) {
+  return rope(rope::join(a.mRoot, b.mRoot));
+}
+
+inline bool operator==(const rope& a, const rope& b) {
+  return a.size() == b.size() && a.str() == b.str();
+}
+inline bool operator!=(const rope& a, const rope& b) { return !(a == b); }
+inline bool operator< (const rope& a, const rope& b) { return a.str() < b.str(); }
+
+inline rope operator+(const rope& a, const rope& b) { return concat(a, b); }
+
+inline std::ostream& operator<<(std::ostream& os, const rope& r) {
+  r.forEachChunk([&](const string_ref& c) { os.write(c.data(), c.size()); });
+  return os;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// showSize / showTo
+
+inline size_t showSize(const rope& r) { return r.size(); }
+
+inline void showTo(string& s, const rope& r) {
+  r.forEachChunk([&](const string_ref& c) { s.append(c.data(), c.size()); });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// cons
+
+inline rope cons(char t, const rope& r) {
+  return concat(rope(string(1, t)), r);
+}
+inline rope cons(const rope& r0, const rope& r1) {
+  return concat(r0, r1);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// append
+
+inline rope append(const rope& r, char t) {
+  return concat(r, rope(string(1, t)));
+}
+inline rope append(const rope& r0, const rope& r1) {
+  return concat(r0, r1);
+}
+
+} /* namespace fp */
+
+#endif /* _FP_ROPE_H_ */
@@ -0,0 +1,268 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_SPATIAL_H_
+#define _FP_SPATIAL_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Spatial operations
+///////////////////////////////////////////////////////////////////////////
+
+typedef types<float,float>::pair point2;
+
+template<typename T> class spatial_index;
+
+///////////////////////////////////////////////////////////////////////////
+// spatial_view
+
+// Lazy view of the indexed values within a radius of some point.  Cells of
+// a grid row are contiguous in the index, so the view walks one span of
+// values per row and skips those outside the radius.
+template<typename T>
+class spatial_view {
+public:
+
+  class const_iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef T                         value_type;
+    typedef ptrdiff_t                 difference_type;
+    typedef const T*                  pointer;
+    typedef const T&                  reference;
+
+    const_iterator() : v(nullptr), row(0), i(0), last(0) { }
+    const_iterator(const spatial_view* v_) : v(v_), row(v_->mRow0), i(0), last(0) {
+      advance();
+    }
+
+    const T& operator*()  const { return v->mIndex->mItems[i]; }
+    const T* operator->() const { return &**this; }
+
+    const_iterator& operator++()    { ++i; advance(); return *this; }
+    const_iterator  operator++(int) { const_iterator it(*this); ++*this; return it; }
+
+    bool operator==(const const_iterator& o) const { return v == o.v && i == o.i; }
+    bool operator!=(const const_iterator& o) const { return !(*this == o); }
+
+  private:
+    void advance() {
+      for (;;) {
+        for (; i < last; ++i) {
+          if (v->contains(v->mIndex->mPoints[i]))
+            return;
+        }
+        if (row >= v->mRow1) {
+          v = nullptr; i = 0;
+          return;
+        }
+        const size_t cell = row++ * v->mIndex->mCellsX;
+        i    = v->mIndex->mCellStart[cell + v->mCol0];
+        last = v->mIndex->mCellStart[cell + v->mCol1];
+      }
+    }
+
+    const spatial_view* v;
+    size_t row, i, last;
+  };
+  typedef const_iterator iterator;
+  typedef T              value_type;
+
+  spatial_view(const spatial_index<T>& index, point2 p, float r)
+    : mIndex(&index), mPoint(p), mRadius2(r*r), mRow0(0), mRow1(0), mCol0(0), mCol1(0) {
+    if (index.mItems.empty())
+      return;
+    mCol0 = index.column(fst(p) - r);
+    mCol1 = index.column(fst(p) + r) + 1;
+    mRow0 = index.row(snd(p) - r);
+    mRow1 = index.row(snd(p) + r) + 1;
+  }
+
+  const_iterator begin() const { return const_iterator(this); }
+  const_iterator end()   const { return const_iterator(); }
+
+  size_t size()  const { return std::distance(begin(), end()); }
+  bool   empty() const { return begin() == end(); }
+
+  inline bool contains(const point2& q) const {
+    const float dx = fst(q) - fst(mPoint);
+    const float dy = snd(q) - snd(mPoint);
+    return dx*dx + dy*dy < mRadius2;
+  }
+
+private:
+  const spatial_index<T>* mIndex;
+  point2 mPoint;
+  float  mRadius2;
+  size_t mRow0, mRow1, mCol0, mCol1;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// spatial_index
+
+// Uniform grid over the bounding box of a list of values, built in O(n) with
+// a counting sort of the values by cell.  The grid never has more than ~2n
+// cells; sparse inputs get coarser cells rather than more memory.
+template<typename T>
+class spatial_index {
+public:
+  typedef T                      value_type;
+  typedef spatial_view<T>        view;
+  typedef typename types<T>::list list;
+
+  spatial_index() : mBaseCellSize(1.f), mCellSize(1.f), mMinX(0), mMinY(0), mCellsX(0), mCellsY(0) { }
+
+  template<typename C, typename PosF>
+  spatial_index(const C& c, PosF posOf, float cellSize)
+    : mBaseCellSize(cellSize > 0.f ? cellSize : 1.f), mCellSize(mBaseCellSize) {
+    rebuild(c, posOf);
+  }
+
+  template<typename C, typename PosF>
+  void rebuild(const C& c, PosF posOf) {
+    const size_t n = length(c);
+    types<point2>::list points;
+    points.reserve(n);
+    std::transform(extent(c), back(points), [&](const T& t) -> point2 {
+      let p = posOf(t);
+      return point2((float)fst(p), (float)snd(p));
+    });
+
+    float maxX = 0, maxY = 0;
+    mMinX = mMinY = 0;
+    if (n > 0) {
+      mMinX = maxX = fst(points[0]);
+      mMinY = maxY = snd(points[0]);
+    }
+    std::for_each(extent(points), [&](const point2& p) {
+      mMinX = std::min(mMinX, fst(p)); maxX = std::max(maxX, fst(p));
+      mMinY = std::min(mMinY, snd(p)); maxY = std::max(maxY, snd(p));
+    });
+
+    // Coarsened from the configured size afresh, so rebuilds do not compound
+    const size_t maxCells = 2 * n + 1;
+    mCellSize = mBaseCellSize;
+    for (;;) {
+      mCellsX = (size_t)((maxX - mMinX) / mCellSize) + 1;
+      mCellsY = (size_t)((maxY - mMinY) / mCellSize) + 1;
+      if (mCellsX * mCellsY <= maxCells || mCellsX * mCellsY == 0)
+        break;
+      mCellSize *= std::sqrt((float)(mCellsX * mCellsY) / maxCells) * 1.01f;
+    }
+
+    // Counting sort by cell: mCellStart[cell] is the first slot of the cell
+    const size_t cells = mCellsX * mCellsY;
+    types<size_t>::list cellOf(n);
+    mCellStart.assign(cells + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+      cellOf[i] = row(snd(points[i])) * mCellsX + column(fst(points[i]));
+      ++mCellStart[cellOf[i] + 1];
+    }
+    std::partial_sum(extent(mCellStart), begin(mCellStart));
+
+    types<size_t>::list slot(begin(mCellStart), end(mCellStart) - 1);
+    mOrder.resize(n);
+    mPoints.resize(n);
+    mItems.clear();
+    mItems.resize(n);
+    let it = begin(c);
+    for (size_t i = 0; i < n; ++i, ++it) {
+      const size_t s = slot[cellOf[i]]++;
+      mOrder[s]  = i;
+      mPoints[s] = points[i];
+      mItems[s]  = *it;
+    }
+  }
+
+  size_t size()     const { return mItems.size(); }
+  float  cellSize() const { return mCellSize; }
+
+  // Values in cell order, with their positions and original list indices
+  const list&                         items()  const { return mItems; }
+  const types<point2>::list&          points() const { return mPoints; }
+  const types<size_t>::list&          order()  const { return mOrder; }
+
+private:
+  friend class spatial_view<T>;
+
+  inline size_t column(float x) const {
+    const float c = (x - mMinX) / mCellSize;
+    return c <= 0.f ? 0 : std::min((size_t)c, mCellsX - 1);
+  }
+  inline size_t row(float y) const {
+    const float r = (y - mMinY) / mCellSize;
+    return r <= 0.f ? 0 : std::min((size_t)r, mCellsY - 1);
+  }
+
+  float  mBaseCellSize;
+  float  mCellSize;
+  float  mMinX, mMinY;
+  size_t mCellsX, mCellsY;
+  types<size_t>::list mCellStart;
+  types<size_t>::list mOrder;
+  types<point2>::list mPoints;
+  list                mItems;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// spatialIndex
+
+// Example: spatialIndex(boids, &pos, NEIGHBORHOOD)
+template<typename C, typename PosF>
+inline spatial_index< value_type_of(C) > spatialIndex(const C& c, PosF posOf, float cellSize) {
+  return spatial_index< value_type_of(C) >(c, posOf, cellSize);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// withinRadius
+
+template<typename T, typename P>
+inline spatial_view<T> withinRadius(const spatial_index<T>& index, const P& p, float r) {
+  return spatial_view<T>(index, point2((float)fst(p), (float)snd(p)), r);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// filter
+
+template<typename F, typename T>
+inline typename types<T>::list filter(F f, const spatial_view<T>& v) {
+  typename types<T>::list result;
+  std::copy_if(extent(v), back(result), f);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// mapWithinRadius
+
+// Parallel map of f(t, withinRadius(index, pos(t), r)) over the indexed
+// values, in their original order.  Values are visited in cell order so
+// neighboring queries touch the same memory.
+template<typename F, typename T>
+inline auto mapWithinRadius(F f, float r, const spatial_index<T>& index)
+    -> typename types< nonconstref_type_of(decltype(f(std::declval<const T&>(), std::declval<const spatial_view<T>&>()))) >::list {
+  typedef typename types< nonconstref_type_of(decltype(f(std::declval<const T&>(), std::declval<const spatial_view<T>&>()))) >::list result_type;
+  result_type result(index.size());
+  parallelFor(index.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      result[index.order()[i]] = f(index.items()[i], spatial_view<T>(index, index.points()[i], r));
+    }
+  }, FP_PARALLEL_GRAIN / 8);
+  return result;
+}
+
+} /* namespace fp */
+
+#endif /* _FP_SPATIAL_H_ */
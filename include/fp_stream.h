@@ -0,0 +1,366 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_STREAM_H_
+#define _FP_STREAM_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_maybe.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// Streams
+///////////////////////////////////////////////////////////////////////////
+
+// A finite lazy list: each call yields just the next value, then Nothing
+// once the stream is done.  Streams are single pass and copies share their
+// position, so a stream can be handed to map/filter/take and consumed
+// through the result.  Iterating a stream consumes it.
+template<typename T>
+class stream {
+public:
+  typedef T                         value_type;
+  typedef std::function<Maybe<T>()> generator;
+
+  class iterator {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef T                       value_type;
+    typedef ptrdiff_t               difference_type;
+    typedef const T*                pointer;
+    typedef const T&                reference;
+
+    iterator() : mStream(nullptr) { }
+    explicit iterator(const stream* s) : mStream(s) { ++*this; }
+
+    const T& operator*()  const { return *mValue; }
+    const T* operator->() const { return &*mValue; }
+
+    iterator& operator++() {
+      mValue = (*mStream)();
+      if (!mValue) mStream = nullptr;
+      return *this;
+    }
+    iterator operator++(int) { iterator it(*this); ++*this; return it; }
+
+    bool operator==(const iterator& o) const { return mStream == o.mStream; }
+    bool operator!=(const iterator& o) const { return mStream != o.mStream; }
+
+  private:
+    const stream* mStream;
+    Maybe<T>      mValue;
+  };
+  typedef iterator const_iterator;
+
+  stream() { }
+  explicit stream(generator g) : mNext(std::make_shared<generator>(std::move(g))) { }
+
+  Maybe<T> operator()() const { return mNext ? (*mNext)() : Maybe<T>(); }
+
+  iterator begin() const { return iterator(this); }
+  iterator end()   const { return iterator(); }
+
+private:
+  std::shared_ptr<generator> mNext;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// fromList
+
+template<typename C>
+inline stream< value_type_of(C) > fromList(C c) {
+  typedef value_type_of(C) T;
+  let source = std::make_shared<C>(std::move(c));
+  let it     = std::make_shared<typename C::const_iterator>(source->begin());
+  return stream<T>([=]() -> Maybe<T> {
+    return *it != source->end() ? Maybe<T>(*(*it)++) : Maybe<T>();
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// list
+
+template<typename T>
+inline typename types<T>::list list(const stream<T>& s) {
+  typename types<T>::list result;
+  for (Maybe<T> t = s(); t; t = s())
+    result.push_back(std::move(*t));
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// map
+
+template<typename F, typename T>
+inline auto map(F f, stream<T> s) -> stream< nonconstref_type_of(decltype(f(std::declval<T>()))) > {
+  typedef nonconstref_type_of(decltype(f(std::declval<T>()))) U;
+  return stream<U>([=]() -> Maybe<U> {
+    Maybe<T> t = s();
+    return t ? Maybe<U>(f(*t)) : Maybe<U>();
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// filter
+
+template<typename F, typename T>
+inline stream<T> filter(F f, stream<T> s) {
+  return stream<T>([=]() -> Maybe<T> {
+    Maybe<T> t = s();
+    while (t && !f(*t))
+      t = s();
+    return t;
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// take
+
+template<typename T>
+inline stream<T> take(size_t n, stream<T> s) {
+  let left = std::make_shared<size_t>(n);
+  return stream<T>([=]() -> Maybe<T> {
+    if (*left == 0)
+      return Maybe<T>();
+    --*left;
+    return s();
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// takeWhile
+
+template<typename F, typename T>
+inline stream<T> takeWhile(F f, stream<T> s) {
+  let done = std::make_shared<bool>(false);
+  return stream<T>([=]() -> Maybe<T> {
+    if (*done)
+      return Maybe<T>();
+    Maybe<T> t = s();
+    if (t && f(*t))
+      return t;
+    *done = true;
+    return Maybe<T>();
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Sharing a stream
+///////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+// tee
+
+// The values read from the source but not yet by every consumer, in a
+// ring of at most capacity values.  A consumer that gets capacity values
+// ahead of the slowest one waits for it; a consumer that is dropped stops
+// holding values back.
+template<typename T>
+class __tee_buffer__ {
+public:
+  __tee_buffer__(stream<T> source, size_t consumers, size_t capacity)
+    : mSource(std::move(source)), mCapacity(std::max<size_t>(capacity, 1)), mFirst(0), mDone(false),
+      mPositions(consumers, 0), mLive(consumers, true) { }
+
+  Maybe<T> next(size_t c) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+      const uint64_t pos = mPositions[c];
+      if (pos < mFirst + mBuffer.size()) {
+        Maybe<T> t(mBuffer[(size_t)(pos - mFirst)]);
+        ++mPositions[c];
+        trim();
+        return t;
+      }
+      if (mDone)
+        return Maybe<T>();
+      if (mBuffer.size() < mCapacity) {
+        Maybe<T> t = mSource();
+        if (!t) {
+          mDone = true;
+          mChanged.notify_all();
+          return t;
+        }
+        mBuffer.push_back(*t);
+        ++mPositions[c];
+        trim();
+        mChanged.notify_all();
+        return t;
+      }
+      mChanged.wait(lock);
+    }
+  }
+
+  void drop(size_t c) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLive[c] = false;
+    trim();
+  }
+
+private:
+  // Frees the values every live consumer has read
+  void trim() {
+    uint64_t slowest = mFirst + mBuffer.size();
+    for (size_t i = 0; i < mPositions.size(); ++i) {
+      if (mLive[i]) slowest = std::min(slowest, mPositions[i]);
+    }
+    if (slowest == mFirst)
+      return;
+    for (; mFirst < slowest; ++mFirst)
+      mBuffer.pop_front();
+    mChanged.notify_all();
+  }
+
+  stream<T>               mSource;
+  size_t                  mCapacity;
+  std::deque<T>           mBuffer;
+  uint64_t                mFirst;     // Index in the source of mBuffer.front()
+  bool                    mDone;
+  types<uint64_t>::list   mPositions;
+  types<bool>::list       mLive;
+  std::mutex              mMutex;
+  std::condition_variable mChanged;
+};
+
+// n streams that each read every value of s, which is read once.  The
+// consumers may run on their own threads, each at its own pace, holding
+// back at most capacity values: one that gets that far ahead of the
+// slowest waits for it.  Consumers on one thread have to take turns,
+// staying fewer than capacity values apart, or the one ahead waits forever.
+// Example: let ts = tee( 2, values ); sum on ts[0] and maximum on ts[1], one thread each
+template<typename T>
+inline typename types< stream<T> >::list tee(size_t n, stream<T> s, size_t capacity = 1024) {
+  // Releases a consumer's hold on the buffer when its last copy goes
+  struct consumer {
+    consumer(std::shared_ptr< __tee_buffer__<T> > b, size_t i) : buffer(std::move(b)), index(i) { }
+    ~consumer() { buffer->drop(index); }
+    std::shared_ptr< __tee_buffer__<T> > buffer;
+    size_t                               index;
+  };
+
+  let buffer = std::make_shared< __tee_buffer__<T> >(std::move(s), n, capacity);
+  typename types< stream<T> >::list result;
+  for (size_t i = 0; i < n; ++i) {
+    let c = std::make_shared<consumer>(buffer, i);
+    result.push_back(stream<T>([=]() { return c->buffer->next(c->index); }));
+  }
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// splitAt / span
+
+// A source split into a prefix and the rest, read independently: values
+// of the prefix that the rest skips past before the prefix is read are
+// kept for it, unless the prefix stream is gone.  Prefix decides where
+// the prefix ends: ended() without reading a value, or takes(t) false at
+// the first value of the rest.
+template<typename T, typename Prefix>
+class __split_stream__ {
+public:
+  __split_stream__(stream<T> source, Prefix prefix)
+    : mSource(std::move(source)), mPrefix(std::move(prefix)), mPrefixDone(false) { }
+
+  Maybe<T> first() {
+    if (!mPending.empty()) {
+      Maybe<T> t(std::move(mPending.front()));
+      mPending.pop_front();
+      return t;
+    }
+    if (mPrefixDone)
+      return Maybe<T>();
+    return pull(false);
+  }
+
+  Maybe<T> rest() {
+    while (!mPrefixDone)
+      pull(!mFirstAlive.expired());
+    if (mBoundary) {
+      Maybe<T> t(std::move(mBoundary));
+      mBoundary = Maybe<T>();
+      return t;
+    }
+    return mSource();
+  }
+
+  void watch(const std::shared_ptr<void>& first) { mFirstAlive = first; }
+
+private:
+  // The next value of the prefix, kept for the prefix stream if asked
+  Maybe<T> pull(bool keep) {
+    if (mPrefix.ended()) {
+      mPrefixDone = true;
+      return Maybe<T>();
+    }
+    Maybe<T> t = mSource();
+    if (t && mPrefix.takes(*t)) {
+      if (keep) mPending.push_back(*t);
+      return t;
+    }
+    mPrefixDone = true;
+    mBoundary   = t;
+    return Maybe<T>();
+  }
+
+  stream<T>             mSource;
+  Prefix                mPrefix;
+  bool                  mPrefixDone;
+  Maybe<T>              mBoundary;
+  std::deque<T>         mPending;
+  std::weak_ptr<void>   mFirstAlive;
+};
+
+template<typename T, typename Prefix>
+inline pair< stream<T>, stream<T> > __split__(stream<T> s, Prefix prefix) {
+  let split = std::make_shared< __split_stream__<T, Prefix> >(std::move(s), std::move(prefix));
+  let alive = std::make_shared<bool>(true);
+  split->watch(alive);
+  return std::make_pair(stream<T>([=]() { (void)alive; return split->first(); }),
+                        stream<T>([=]() { return split->rest(); }));
+}
+
+struct __count_prefix__ {
+  explicit __count_prefix__(size_t n) : left(n) { }
+  bool ended() const { return left == 0; }
+  template<typename T>
+  bool takes(const T&) { --left; return true; }
+  size_t left;
+};
+
+template<typename F>
+struct __while_prefix__ {
+  explicit __while_prefix__(F f_) : f(std::move(f_)) { }
+  bool ended() const { return false; }
+  template<typename T>
+  bool takes(const T& t) { return f(t) ? true : false; }
+  F f;
+};
+
+// The first n values and the rest, which can be read in either order
+template<typename T>
+inline pair< stream<T>, stream<T> > splitAt(size_t n, stream<T> s) {
+  return __split__(std::move(s), __count_prefix__(n));
+}
+
+// The longest prefix whose values satisfy f, and the rest
+template<typename F, typename T>
+inline pair< stream<T>, stream<T> > span(F f, stream<T> s) {
+  return __split__(std::move(s), __while_prefix__<F>(std::move(f)));
+}
+
+} /* namespace fp */
+
+#endif /* _FP_STREAM_H_ */
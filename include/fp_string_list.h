@@ -0,0 +1,284 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_STRING_LIST_H_
+#define _FP_STRING_LIST_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+#include "fp_string_ref.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// __string_iterator__
+
+// Random access by index over a list whose elements read as std::string
+// values; view() gives the element as a string_ref instead.
+template<typename L>
+class __string_iterator__ {
+public:
+  typedef std::random_access_iterator_tag iterator_category;
+  typedef string                          value_type;
+  typedef ptrdiff_t                       difference_type;
+  typedef const string*                   pointer;
+  typedef string                          reference;
+
+  __string_iterator__() : mList(nullptr), mIndex(0) { }
+  __string_iterator__(const L* l, size_t i) : mList(l), mIndex(i) { }
+
+  string     operator*()             const { return (*mList)[mIndex].str(); }
+  string     operator[](ptrdiff_t n) const { return (*mList)[mIndex + n].str(); }
+  string_ref view()                  const { return (*mList)[mIndex]; }
+  size_t     index()                 const { return mIndex; }
+
+  __string_iterator__& operator++()   { ++mIndex; return *this; }
+  __string_iterator__& operator--()   { --mIndex; return *this; }
+  __string_iterator__  operator++(int) { __string_iterator__ it(*this); ++mIndex; return it; }
+  __string_iterator__  operator--(int) { __string_iterator__ it(*this); --mIndex; return it; }
+  __string_iterator__& operator+=(ptrdiff_t n) { mIndex += n; return *this; }
+  __string_iterator__& operator-=(ptrdiff_t n) { mIndex -= n; return *this; }
+  __string_iterator__  operator+(ptrdiff_t n) const { return __string_iterator__(mList, mIndex + n); }
+  __string_iterator__  operator-(ptrdiff_t n) const { return __string_iterator__(mList, mIndex - n); }
+  ptrdiff_t operator-(const __string_iterator__& o) const { return (ptrdiff_t)mIndex - (ptrdiff_t)o.mIndex; }
+
+  bool operator==(const __string_iterator__& o) const { return mIndex == o.mIndex; }
+  bool operator!=(const __string_iterator__& o) const { return mIndex != o.mIndex; }
+  bool operator< (const __string_iterator__& o) const { return mIndex <  o.mIndex; }
+  bool operator> (const __string_iterator__& o) const { return mIndex >  o.mIndex; }
+  bool operator<=(const __string_iterator__& o) const { return mIndex <= o.mIndex; }
+  bool operator>=(const __string_iterator__& o) const { return mIndex >= o.mIndex; }
+
+private:
+  const L* mList;
+  size_t   mIndex;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// string_list
+///////////////////////////////////////////////////////////////////////////
+
+// A list of strings kept as one run of chars plus the end offset of each
+// string: 4 bytes per string on top of its chars, instead of a std::string
+// and its heap block.  Elements read as std::string values, so functions
+// of strings work as before; operator[] gives a string_ref into the list
+// instead.  Holds up to 4GB of chars.  packedLines, packedWords and
+// packedSplit build one from a string.
+// Example: fp::sort( fp::packedLines( text ) )
+class string_list {
+public:
+  typedef string    value_type;
+  typedef string    reference;
+  typedef string    const_reference;
+  typedef size_t    size_type;
+  typedef ptrdiff_t difference_type;
+
+  typedef __string_iterator__<string_list>      const_iterator;
+  typedef const_iterator                        iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+  typedef const_reverse_iterator                reverse_iterator;
+
+  string_list() { }
+  string_list(std::initializer_list<string_ref> l) { assign(l.begin(), l.end()); }
+  template<typename It>
+  string_list(It first, It last) { assign(first, last); }
+
+  template<typename It>
+  void assign(It first, It last) {
+    clear();
+    for (; first != last; ++first)
+      push_back(*first);
+  }
+
+  size_t size()  const { return mEnds.size(); }
+  bool   empty() const { return mEnds.empty(); }
+
+  // Room for n strings of chars chars in all
+  void reserve(size_t n, size_t chars = 0) {
+    mEnds.reserve(n);
+    mChars.reserve(chars);
+  }
+
+  void clear() {
+    mEnds.clear();
+    mChars.clear();
+  }
+
+  string_ref operator[](size_t i) const {
+    const size_t first = i == 0 ? 0 : mEnds[i - 1];
+    return string_ref(mChars.data() + first, mEnds[i] - first);
+  }
+
+  string front() const { return (*this)[0].str(); }
+  string back()  const { return (*this)[size() - 1].str(); }
+
+  void push_back(const string_ref& s) {
+    if (mChars.size() + s.size() > UINT32_MAX)
+      throw std::length_error("string_list");
+    mChars.append(s.data(), s.size());
+    mEnds.push_back((uint32_t)mChars.size());
+  }
+
+  void pop_back() {
+    mEnds.pop_back();
+    mChars.resize(mEnds.empty() ? 0 : mEnds.back());
+  }
+
+  iterator insert(const_iterator pos, const string_ref& s) {
+    const size_t i = pos.index();
+    if (i == size()) {
+      push_back(s);
+    } else {
+      if (mChars.size() + s.size() > UINT32_MAX)
+        throw std::length_error("string_list");
+      const size_t first = i == 0 ? 0 : mEnds[i - 1];
+      mChars.insert(first, s.data(), s.size());
+      mEnds.insert(mEnds.begin() + i, (uint32_t)first);
+      for (size_t j = i; j < mEnds.size(); ++j)
+        mEnds[j] += (uint32_t)s.size();
+    }
+    return iterator(this, i);
+  }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end()   const { return const_iterator(this, size()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend()   const { return const_reverse_iterator(begin()); }
+
+  // Every string, one after the other
+  const string& chars() const { return mChars; }
+
+  operator types<string>::list() const {
+    return types<string>::list(begin(), end());
+  }
+
+private:
+  friend bool operator==(const string_list&, const string_list&);
+  friend string_list concat(string_list, const string_list&);
+
+  string                    mChars;
+  types<uint32_t>::list     mEnds;
+};
+
+inline bool operator==(const string_list& a, const string_list& b) {
+  return a.mEnds == b.mEnds && a.mChars == b.mChars;
+}
+inline bool operator!=(const string_list& a, const string_list& b) { return !(a == b); }
+inline bool operator< (const string_list& a, const string_list& b) {
+  for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+    const int c = a[i].compare(b[i]);
+    if (c != 0)
+      return c < 0;
+  }
+  return a.size() < b.size();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// filter
+
+// f(s) for functions of a string_ref, f(s.str()) for functions of a string
+template<typename F>
+inline auto __applyView__(F& f, const string_ref& s, int) -> decltype(f(s)) {
+  return f(s);
+}
+template<typename F>
+inline auto __applyView__(F& f, const string_ref& s, long) -> decltype(f(s.str())) {
+  return f(s.str());
+}
+
+template<typename F>
+inline string_list filter(F f, const string_list& c) {
+  string_list result;
+  for (size_t i = 0; i < c.size(); ++i) {
+    if (__applyView__(f, c[i], 0))
+      result.push_back(c[i]);
+  }
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// sort
+
+// The first 8 chars of s as a big-endian number, zero padded
+inline uint64_t __prefixKey__(const string_ref& s) {
+  unsigned char b[8] = { 0 };
+  memcpy(b, s.data(), std::min<size_t>(s.size(), 8));
+  uint64_t key = 0;
+  for (size_t i = 0; i < 8; ++i)
+    key = (key << 8) | b[i];
+  return key;
+}
+
+// Sorts (prefix, index) pairs: most comparisons are decided by the prefix
+// without touching the chars, and the chars are copied once at the end.
+inline string_list sort(const string_list& c) {
+  struct key { uint64_t prefix; uint32_t index; };
+  types<key>::list keys(c.size());
+  for (size_t i = 0; i < c.size(); ++i) {
+    keys[i].prefix = __prefixKey__(c[i]);
+    keys[i].index  = (uint32_t)i;
+  }
+  std::sort(extent(keys), [&](const key& a, const key& b) {
+    if (a.prefix != b.prefix)
+      return a.prefix < b.prefix;
+    return c[a.index] < c[b.index];
+  });
+
+  string_list result;
+  result.reserve(c.size(), c.chars().size());
+  for (size_t i = 0; i < keys.size(); ++i)
+    result.push_back(c[keys[i].index]);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// group
+
+inline types<string_list>::list group(const string_list& c) {
+  types<string_list>::list result;
+  for (size_t i = 0; i < c.size(); ++i) {
+    if (i == 0 || c[i] != c[i - 1])
+      result.push_back(string_list());
+    result.back().push_back(c[i]);
+  }
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// concat
+
+inline string_list concat(string_list a, const string_list& b) {
+  if (a.mChars.size() + b.mChars.size() > UINT32_MAX)
+    throw std::length_error("string_list");
+  const uint32_t offset = (uint32_t)a.mChars.size();
+  a.mChars.append(b.mChars);
+  a.mEnds.reserve(a.mEnds.size() + b.mEnds.size());
+  for (size_t i = 0; i < b.mEnds.size(); ++i)
+    a.mEnds.push_back(b.mEnds[i] + offset);
+  return a;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// reverse
+
+inline string_list reverse(const string_list& c) {
+  string_list result;
+  result.reserve(c.size(), c.chars().size());
+  for (size_t i = c.size(); i > 0; --i)
+    result.push_back(c[i - 1]);
+  return result;
+}
+
+} /* namespace fp */
+
+#endif /* _FP_STRING_LIST_H_ */
@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2012, Jared Duke.
+// This code is released under the MIT License.
+// www.opensource.org/licenses/mit-license.php
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FP_STRING_REF_H_
+#define _FP_STRING_REF_H_
+
+#include "fp_defines.h"
+#include "fp_common.h"
+
+#include <algorithm>
+#include <string.h>
+#include <type_traits>
+
+namespace fp {
+
+///////////////////////////////////////////////////////////////////////////
+// string_ref
+///////////////////////////////////////////////////////////////////////////
+
+// Non-owning view of a run of chars; the viewed string must outlive it.
+// Example: words(string_ref(text)) splits text without copying a token.
+class string_ref {
+public:
+  typedef char        value_type;
+  typedef const char* iterator;
+  typedef const char* const_iterator;
+  typedef size_t      size_type;
+
+  string_ref()                                : mData(""),   mSize(0)             { }
+  string_ref(const char* s)                   : mData(s),    mSize(strlen(s))     { }
+  string_ref(const char* s, size_t n)         : mData(s),    mSize(n)             { }
+  string_ref(const char* first, const char* last) : mData(first), mSize(last - first) { }
+  string_ref(const string& s)                 : mData(s.data()), mSize(s.size())  { }
+
+  inline const_iterator begin() const { return mData; }
+  inline const_iterator end()   const { return mData + mSize; }
+  inline const char*    data()  const { return mData; }
+  inline size_t         size()  const { return mSize; }
+  inline size_t         length() const { return mSize; }
+  inline bool           empty() const { return mSize == 0; }
+
+  inline char operator[](size_t i) const { return mData[i]; }
+
+  inline string_ref substr(size_t pos, size_t n = string::npos) const {
+    pos = std::min(pos, mSize);
+    return string_ref(mData + pos, std::min(n, mSize - pos));
+  }
+
+  inline string str() const { return string(mData, mSize); }
+
+  inline int compare(const string_ref& o) const {
+    const int c = memcmp(mData, o.mData, std::min(mSize, o.mSize));
+    return c != 0 ? c : (mSize < o.mSize ? -1 : mSize > o.mSize ? 1 : 0);
+  }
+
+private:
+  const char* mData;
+  size_t      mSize;
+};
+
+inline bool operator==(const string_ref& a, const string_ref& b) {
+  return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+inline bool operator!=(const string_ref& a, const string_ref& b) { return !(a == b); }
+inline bool operator< (const string_ref& a, const string_ref& b) { return a.compare(b) < 0; }
+
+template<typename T>
+struct is_string { static const bool value = std::is_same<T,string>::value || std::is_same<T,string_ref>::value; };
+
+///////////////////////////////////////////////////////////////////////////
+// split
+
+// As split on a string, but the pieces view s
+inline types<string_ref>::list split(const string_ref& s, char delim) {
+  types<string_ref>::list elems;
+  const char* first = s.begin();
+  const char* last  = s.end();
+  while (first != last) {
+    const char* next = (const char*)memchr(first, delim, last - first);
+    if (!next) next = last;
+    elems.push_back(string_ref(first, next));
+    first = next == last ? last : next + 1;
+  }
+  return elems;
+}
+
+} /* namespace fp */
+
+#endif /* _FP_STRING_REF_H_ */
@@ -23,7 +23,22 @@
 #include "fp_composition.h"
 #include "fp_composition_compound.h"
 
+#include "fp_stream.h"
+#include "fp_lazy.h"
+#include "fp_chunked.h"
+#include "fp_generator.h"
 #include "fp_io.h"
+#include "fp_format.h"
+#include "fp_read.h"
+#include "fp_csv.h"
+#include "fp_match.h"
+#include "fp_intern.h"
+#include "fp_memoize.h"
+
+#include "fp_parallel.h"
+#include "fp_channel.h"
+#include "fp_future.h"
+#include "fp_spatial.h"
 
 #include "fp_maybe.h"
 
@@ -20,7 +20,9 @@
 #endif
 
 #if ENABLE_BENCHMARK
+// timed_run reports through std::cout, so fp::print output goes out first
 #define BENCHMARK(desc,func,iters) {     \
+    fp::flush();                         \
     timed_run timed(desc);               \
     for (size_t i = 0; i < iters; ++i) { \
       func;                              \
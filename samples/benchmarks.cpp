@@ -11,6 +11,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <deque>
+#include <regex>
 #include <set>
 #include <unordered_set>
 
@@ -91,6 +92,31 @@ void unique( size_t count, size_t iters = ITER_MULT ) {
 
 ///////////////////////////////////////////////////////////////////////////
 
+size_t matchCount( const types<string>::list& paths, const std::regex& r ) {
+  return fp::length( fp::filter( [&](const string& p) { return std::regex_match( p, r ); }, paths ) );
+}
+template <typename M>
+size_t matchCount( const types<string>::list& paths, const M& m ) {
+  return fp::length( fp::filter( m, paths ) );
+}
+
+void match( size_t count, size_t iters = ITER_MULT ) {
+  static const char* exts[] = { "mp3", "wav", "ogg", "wma", "flac", "txt", "jpg", "M3U" };
+  types<string>::list paths;
+  for (size_t i = 0; i < count; ++i)
+    paths.emplace_back( "/home/user/music/" + show( uniformN( 12, 'a', 'z' ) ) + "." + exts[i % 8] );
+
+  print( "Length = " + show(length(paths)) + " - Iters = " + show(iters));
+  const std::regex songRegex( "^.*.\\.(mp3|wav|ogg|wma|flac)$", std::regex::icase );
+  const let songs = extensionSet( types<string>::list({ "mp3", "wav", "ogg", "wma", "flac" }) );
+  const let songGlobs = globSet( types<string>::list({ "*.mp3", "*.wav", "*.ogg", "*.wma", "*.flac" }) );
+  run( (void)matchCount( paths, songRegex ), iters );
+  run( (void)matchCount( paths, songs ),     iters );
+  run( (void)matchCount( paths, songGlobs ), iters );
+}
+
+///////////////////////////////////////////////////////////////////////////
+
 int main(int argc, char **argv) {
 
   print( "" );
@@ -102,5 +128,10 @@ int main(int argc, char **argv) {
 
   print( "" );
 
+  match( 1000,   100 * ITER_MULT );
+  match( 100000,   1 * ITER_MULT );
+
+  print( "" );
+
   return 0;
 }
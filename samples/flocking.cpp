@@ -140,16 +140,18 @@ Boid evolve( const Boid& boid, const Boids& neighbors ) {
 
 Boids evolve( const Boids& boids, size_t x, size_t y ) {
 
-  return fp::map( [=,&boids]( const Boid& boid ) -> Boid {
+  // Rebuilt every step in O(n); each boid only visits the grid cells around it
+  let index = fp::spatialIndex( boids, &pos, (float)NEIGHBORHOOD );
 
-    let neighbors = fp::filter( [=,&boid]( const Boid& otherBoid ) {
-      return ( boid != otherBoid ) &&
-             ( dist( pos(boid), pos(otherBoid) ) < NEIGHBORHOOD );
-    }, boids );
+  return fp::mapWithinRadius( []( const Boid& boid, const fp::spatial_view<Boid>& nearby ) -> Boid {
+
+    let neighbors = fp::filter( [&]( const Boid& otherBoid ) {
+      return boid != otherBoid;
+    }, nearby );
 
     return evolve( boid, neighbors );
 
-  }, boids);
+  }, (float)NEIGHBORHOOD, index );
 }
 
 #ifndef M_PI
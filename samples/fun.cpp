@@ -156,7 +156,7 @@ auto fft( V v ) -> typename types< std::complex< value_type_of(V) > >::list {
 
 ///////////////////////////////////////////////////////////////////////////
 
-typedef pair<char,string> Code;
+typedef pair<char,fp::rope> Code;
 typedef pair<size_t,char> Freq;
 typedef types< Code >::list     Codes;
 typedef types< Freq >::list     Frequencies;
@@ -168,7 +168,7 @@ Codes reduce( fp::types< FreqCodes >::list buf ) {
 
   if (length(buf) == 1) return snd(head(buf));
 
-  let consC = (string(*)(char,string))cons;
+  let consC = (fp::rope(*)(char,const fp::rope&))cons;
   let cons0 = curry(consC, '0');
   let cons1 = curry(consC, '1');
 
@@ -193,11 +193,11 @@ StringList huffman( string s ) {
   };
 
   let result = reduce( map( []( const Freq& f ) {
-    return fp::make_pair( fp::fst(f), Codes(1, fp::make_pair( fp::snd(f), "" )) );
+    return fp::make_pair( fp::fst(f), Codes(1, Code( fp::snd(f), fp::rope() )) );
   }, sortBy( comparing(fstF()), freq(list(s)) ) ) );
 
   return map( [](const Code& c) {
-    return fp::show("\'") + fp::fst(c) + "\' : " + fp::snd(c) + "\n";
+    return fp::show("\'") + fp::fst(c) + "\' : " + fp::show(fp::snd(c)) + "\n";
   }, result );
 
   /*
@@ -4,36 +4,16 @@
 // www.opensource.org/licenses/mit-license.php
 /////////////////////////////////////////////////////////////////////////////
 
-// Clang has compilation issues with the regex include
-#if !defined(__clang__)
-
 #include <fpcpp.h>
 
 #include <fstream>
 #include <string>
 #include <iostream>
-#include <regex>
 
-#include <rapidxml/rapidxml_utils.hpp>
+#include <rapidxml/rapidxml.hpp>
+#include <string.h>
 
 using std::string;
-using std::regex;
-using std::regex_match;
-
-regex extensionRegex(const string& extension) {
-  string result("^.*.\\.(");
-  result.append(extension).append(")$");
-  return regex(result, regex::icase);
-}
-
-template<typename C>
-regex extensionsRegex(const C& extensions) {
-  let extensionsString = fp::foldl1( [](const string& a, const string& b) -> string {
-    let result = a;
-    return result.append("|").append(b);
-  }, extensions );
-  return extensionRegex(extensionsString);
-}
 
 ///////////////////////////////////////////////////////////////////////////
 
@@ -56,7 +36,6 @@ std::array<size_t, NUM_OP_TYPES> OpTypeArgs = {
   2,
   2,
 };
-let invalidOp = [](const fp::FilePath&) { return false; };
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -77,8 +56,8 @@ std::array<string, NUM_SONG_TYPES> SongTypeExtensions = {
   "flac"
 };
 bool songFilter( const fp::FilePath& filePath ) {
-  static const let songRegex = extensionsRegex( SongTypeExtensions );
-  return regex_match( filePath, songRegex );
+  static const let songs = fp::extensionSet( SongTypeExtensions );
+  return songs( filePath );
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -102,39 +81,76 @@ template <PlaylistType P> struct PlaylistUtils;
 
 template<> struct PlaylistUtils<M3U> {
   static Playlist create( const fp::FilePath& filePath ) {
-    let m3uLineFilter = []( const string& line ) {
-      return (!line.empty())  &&
-             ( line[0] != '#') &&
-             ( line.find_first_of(".mp3") != std::string::npos );
+    let m3uLineFilter = []( const fp::string_ref& line ) {
+      return (!line.empty()) && ( line[0] != '#' );
+    };
+    let m3uLine = []( const fp::string_ref& line ) {
+      return line.substr( 0, line.size() - ( line[line.size() - 1] == '\r' ) ).str();
     };
 
-    std::ifstream ifs( filePath );
-    return fp::filter( m3uLineFilter, fp::lines(filePath) );
+    fp::mapped_file m3uFile( filePath );
+    return fp::map( m3uLine, fp::filter( m3uLineFilter, fp::lines( m3uFile.text() ) ) );
   }
 };
 
 template<> struct PlaylistUtils<WPL> {
-  static Playlist create( const fp::FilePath& filePath ) {
-    using namespace rapidxml;
-    file<char> xmlFile( fp::fromString(filePath) );
-    xml_document<> doc;
-    doc.parse<0>(xmlFile.data());
-    let node = doc.first_node("media");
-    let wplLines = [&]() mutable -> string {
-      if (node) {
-        let mp3Attribute = node->first_attribute("src");
-        if (mp3Attribute)
-          return mp3Attribute->value();
-        else
-          return "invalid";
-        node = node->next_sibling("media");
-      } else {
-        return "";
+  // rapidxml parses in place, writing its terminators and decoded entities
+  // into a private mapping of the file, so the src values are views into it
+  struct Document {
+    explicit Document( const fp::FilePath& filePath )
+      : file( filePath, true ), node( nullptr ) {
+      if ( !file.valid() )
+        return;
+      try {
+        doc.parse<rapidxml::parse_no_data_nodes>( file.data() );
+        node = &doc;
+      } catch ( const rapidxml::parse_error& ) { }
+    }
+
+    fp::mapped_file          file;
+    rapidxml::xml_document<> doc;
+    rapidxml::xml_node<>*    node;
+  };
+
+  // The node after node in document order
+  static rapidxml::xml_node<>* next( rapidxml::xml_node<>* node ) {
+    if ( let child = node->first_node() )
+      return child;
+    for ( ; node->parent(); node = node->parent() ) {
+      if ( let sibling = node->next_sibling() )
+        return sibling;
+    }
+    return nullptr;
+  }
+
+  // The src of each media element, found as the stream is read
+  static fp::stream<fp::string_ref> source( const fp::FilePath& filePath ) {
+    let document = std::make_shared<Document>( filePath );
+    return fp::stream<fp::string_ref>( [=]() -> fp::Maybe<fp::string_ref> {
+      while ( document->node && (document->node = next( document->node )) ) {
+        let node = document->node;
+        if ( node->type() == rapidxml::node_element && strcmp( node->name(), "media" ) == 0 ) {
+          if ( let src = node->first_attribute( "src" ) )
+            return fp::just( fp::string_ref( src->value(), src->value_size() ) );
+        }
       }
-    };
-    return fp::takeWhileT( [](const string& s) {
-      return !s.empty();
-    }, wplLines );
+      return fp::Nothing();
+    } );
+  }
+
+  static Playlist create( const fp::FilePath& filePath ) {
+    return fp::list( fp::map( []( const fp::string_ref& src ) { return src.str(); }, source( filePath ) ) );
+  }
+
+  // Many playlists at once, each parsed on its own
+  static Playlist create( const fp::types<fp::FilePath>::list& filePaths ) {
+    let playlists = fp::mapP( []( const fp::FilePath& filePath ) {
+      return create( filePath );
+    }, filePaths );
+    Playlist result;
+    for ( let& playlist : playlists )
+      result.insert( result.end(), extent(playlist) );
+    return result;
   }
 };
 
@@ -144,22 +160,43 @@ template<typename MapOp, typename FilterOp, typename Source>
 bool filteredMap( MapOp mapOp, FilterOp filterOp, Source source ) {
   using namespace fp;
   return all(istrue,
-             map(mapOp,
-                 filter(filterOp,
-                        source)));
+             applyFileOps(
+               map(mapOp,
+                   filter(filterOp,
+                          source))));
 }
 
 Playlist songs( const fp::FilePath& filePath ) {
-  if (        std::regex_match( filePath, extensionRegex( PlaylistTypeExtensions[M3U] ) ) ) {
+  static const let m3u = fp::extensionSet( PlaylistTypeExtensions[M3U] );
+  static const let wpl = fp::extensionSet( PlaylistTypeExtensions[WPL] );
+  if (        m3u( filePath ) ) {
     return PlaylistUtils<M3U>::create( filePath );
-  } else if ( std::regex_match( filePath, extensionRegex( PlaylistTypeExtensions[WPL] ) ) ) {
+  } else if ( wpl( filePath ) ) {
     return PlaylistUtils<WPL>::create( filePath );
   } else {
-    return Playlist();
+    // A directory: walk it, keeping only the songs as they are found
+    return fp::list( fp::filter( &songFilter, fp::map( &fp::entryPath, fp::walkDirectory( filePath ) ) ) );
   }
 }
 
-typedef std::function<bool(const fp::FilePath&)> SongOp;
+Playlist songs( const fp::types<fp::FilePath>::list& filePaths ) {
+  static const let wpl = fp::extensionSet( PlaylistTypeExtensions[WPL] );
+  let result = PlaylistUtils<WPL>::create( fp::filter( wpl, filePaths ) );
+  for ( let& filePath : filePaths ) {
+    if ( !wpl( filePath ) ) {
+      let s = songs( filePath );
+      result.insert( result.end(), extent(s) );
+    }
+  }
+  return result;
+}
+
+string fileName( const fp::FilePath& filePath ) {
+  let slash = filePath.find_last_of("/\\");
+  return slash == string::npos ? filePath : filePath.substr(slash + 1);
+}
+
+typedef std::function<fp::file_op(const fp::FilePath&)> SongOp;
 OpType opType( const string& opName ) {
   for (size_t op = 0; op < NUM_OP_TYPES; ++op) {
     if ( OpTypeNames[op] == opName )
@@ -171,18 +208,22 @@ SongOp operation( int argc, char **argv ) {
 
   let op = opType( argv[1] );
   if (INVALID_OP_TYPE == op)
-    return invalidOp;
+    return SongOp();
 
   let opArgC = OpTypeArgs[op];
-  if (int(opArgC + 2) < argc)
-    return invalidOp;
+  if (argc < int(opArgC + 2))
+    return SongOp();
 
+  const string dir = opArgC > 1 ? string(argv[argc - 1]) + "/" : string();
   switch ( op ) {
     case REMOVE:
+      return [](const fp::FilePath& song) { return fp::removeOp( song ); };
     case COPY:
+      return [=](const fp::FilePath& song) { return fp::copyOp( song, dir + fileName(song) ); };
     case MOVE:
+      return [=](const fp::FilePath& song) { return fp::moveOp( song, dir + fileName(song) ); };
     default:
-      return invalidOp;
+      return SongOp();
   };
 }
 
@@ -192,19 +233,14 @@ int main(int argc, char **argv) {
     return 0;
 
   let songOperation = operation(argc, argv);
+  if (!songOperation)
+    return 1;
 
-  filteredMap( songOperation, &songFilter, songs(argv[2]) );
-
-  //TODO: parse args
-  //TODO: dispatch commands
+  // Everything between the operation and the destination is a source
+  let sources = fp::types<fp::FilePath>::list( argv + 2, argv + argc - (OpTypeArgs[opType( argv[1] )] - 1) );
 
-  return 0;
+  // e.g. playlist move favorites.m3u /media/backup
+  //      playlist copy /media/music /media/backup
+  //      playlist remove lists/*.wpl
+  return filteredMap( songOperation, &songFilter, songs(sources) ) ? 0 : 1;
 }
-
-#else
-
-int main(int argc, char **argv) {
-  return 0;
-}
-
-#endif // !defined(__clang__)
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include <string>
 #include <map>
 #include <fstream>
+#include <regex>
 
 #include "common.h"
 
@@ -474,3 +475,1099 @@ TEST(Curry, Everything) {
   EXPECT_EQ((float)1*2*3*4*5, std::bind(fp::foldl1F(), fp::math::multiplyF(), std::placeholders::_1)(fp::increasingN(5, 1.f)));
 #endif
 }
+
+///////////////////////////////////////////////////////////////////////////
+
+TEST(Parallel, MapP) {
+  using fp::mapP;
+
+  let values = fp::increasingN(100000, 0);
+  EXPECT_EQ(fp::map(mult_4, values), mapP(mult_4, values));
+  EXPECT_EQ(fp::map(div_5,  values), mapP(div_5,  values));
+  EXPECT_TRUE(mapP(mult_4, fp::list<int>()).empty());
+}
+
+TEST(Spatial, WithinRadius) {
+  using fp::withinRadius;
+  typedef fp::point2 P;
+
+  let points = fp::zip(fp::uniformN(5000, 0.f, 100.f), fp::uniformN(5000, 0.f, 50.f));
+  let index  = fp::spatialIndex(points, [](const P& p) { return p; }, 4.f);
+  EXPECT_EQ(points.size(), index.size());
+
+  let near = [](const P& a, const P& b, float r) {
+    return (a.first-b.first)*(a.first-b.first) + (a.second-b.second)*(a.second-b.second) < r*r;
+  };
+  for (size_t i = 0; i < 50; ++i) {
+    const P p = points[i * 97];
+    const float r = 1.f + (float)(i % 7);
+    let expected = fp::sort(fp::filter([&](const P& q) { return near(p, q, r); }, points));
+    let actual   = fp::sort(fp::filter([](const P&) { return true; }, withinRadius(index, p, r)));
+    EXPECT_EQ(expected, actual);
+    EXPECT_EQ(expected.size(), withinRadius(index, p, r).size());
+  }
+
+  EXPECT_TRUE(withinRadius(index, P(-100.f, -100.f), 10.f).empty());
+
+  let counts = fp::mapWithinRadius([](const P&, const fp::spatial_view<P>& v) { return v.size(); }, 3.f, index);
+  for (size_t i = 0; i < points.size(); i += 101) {
+    EXPECT_EQ(withinRadius(index, points[i], 3.f).size(), counts[i]);
+  }
+
+  // Coarsening for a sparse list does not carry over to later rebuilds
+  let sparse = fp::spatialIndex(fp::zip(fp::uniformN(2, 0.f, 1000.f), fp::uniformN(2, 0.f, 1000.f)),
+                                [](const P& p) { return p; }, 1.f);
+  let rebuilt = sparse;
+  let dense = fp::zip(fp::uniformN(5000, 0.f, 10.f), fp::uniformN(5000, 0.f, 10.f));
+  EXPECT_LT(1.f, sparse.cellSize());
+  rebuilt.rebuild(dense, [](const P& p) { return p; });
+  EXPECT_EQ(1.f, rebuilt.cellSize());
+}
+
+TEST(Prelude, RandomStreams) {
+  using fp::math::uniformAt;
+  using fp::math::uniform_;
+
+  const uint64_t seed = 1234;
+  let serial   = fp::uniformN(10000, 0., 1., seed);
+  let parallel = fp::mapP([=](size_t i) { return uniformAt(0., 1., seed, i); }, fp::increasingN(10000, (size_t)0));
+  EXPECT_EQ(serial, parallel);
+  EXPECT_EQ(serial, fp::uniformN(10000, 0., 1., seed));
+  EXPECT_NE(serial, fp::uniformN(10000, 0., 1., seed + 1));
+
+  let ints = fp::uniformN(10000, -3, 3, seed);
+  EXPECT_EQ(-3, fp::minimum(ints));
+  EXPECT_EQ( 3, fp::maximum(ints));
+
+  let gen = uniform_<float>(0.f, 1.f, seed);
+  let a = fp::takeF(100, gen.split(1));
+  let b = fp::takeF(100, gen.split(2));
+  EXPECT_NE(a, b);
+  EXPECT_EQ(a, fp::takeF(100, gen.split(1)));
+
+  fp::math::seed(seed);
+  let x = fp::math::uniform(0, 1000000);
+  fp::math::seed(seed);
+  EXPECT_EQ(x, fp::math::uniform(0, 1000000));
+}
+
+TEST(Prelude, RandomBulk) {
+  using fp::math::uniform_;
+
+  for (size_t n = 0; n < 70; n += 7) {
+    EXPECT_EQ(fp::takeF(n, uniform_<float>(-1.f, 1.f, n)), fp::uniformN(n, -1.f, 1.f, n));
+    EXPECT_EQ(fp::takeF(n, uniform_<int>(0, 9, n)),        fp::uniformN(n, 0, 9, n));
+  }
+
+  fp::math::philox g(99), h(99);
+  g(); h();
+  fp::types<uint64_t>::list bulk(1001);
+  g.generate64(bulk.data(), bulk.size());
+  for (size_t i = 0; i < bulk.size(); ++i)
+    EXPECT_EQ(h.next64(), bulk[i]);
+  EXPECT_EQ(h.next64(), g.next64());
+
+  // From every position within a block
+  for (int skip = 0; skip < 4; ++skip) {
+    fp::math::philox a(7), b(7);
+    for (int i = 0; i < skip; ++i) { a(); b(); }
+    fp::types<uint64_t>::list words(40);
+    a.generate64(words.data(), words.size());
+    for (size_t i = 0; i < words.size(); ++i)
+      EXPECT_EQ(b.next64(), words[i]);
+  }
+}
+
+TEST(Prelude, StringMapFilter) {
+  using fp::map;
+  using fp::filter;
+
+  const std::string text("The Quick brown fox, 1234 jumps over 56 lazy DOGS! 7890 \xe9\xc9 ... and again THE QUICK brown fox");
+  let upper = [](char c) -> char { return (c >= 'a' && c <= 'z') ? c - 32 : c; };
+  let digit = [](char c) { return c >= '0' && c <= '9'; };
+
+  EXPECT_EQ(map(upper, text), map(fp::toUpper(), text));
+  EXPECT_EQ(map(upper, text), map(fp::charMap(upper), text));
+  EXPECT_TRUE(fp::charMap(upper).isRangeShift());
+  EXPECT_EQ("the quick", map(fp::toLower(), std::string("THE QUICK")));
+  EXPECT_EQ("1234567890", filter(digit, text));
+  EXPECT_EQ("1234567890", filter(fp::isDigit(), text));
+  EXPECT_EQ("1234567890", filter(fp::charClass(digit), text));
+  EXPECT_EQ("TQDOGSTHEQUICK", filter(fp::isUpper(), text));
+
+  let vowel = fp::charClass([](char c) { return std::string("aeiou").find(c) != std::string::npos; });
+  EXPECT_FALSE(vowel.isRange());
+  EXPECT_EQ(filter([](char c) { return std::string("aeiou").find(c) != std::string::npos; }, text), filter(vowel, text));
+
+  let rot = fp::charMap([](char c) -> char { return (c >= 'a' && c <= 'z') ? 'a' + (c - 'a' + 13) % 26 : c; });
+  EXPECT_FALSE(rot.isRangeShift());
+  EXPECT_EQ(text, map(rot, map(rot, text)));
+  EXPECT_EQ("", map(fp::toUpper(), std::string()));
+}
+
+TEST(Prelude, Show) {
+  using fp::show;
+
+  EXPECT_EQ("0", show(0));
+  EXPECT_EQ("-42", show(-42));
+  EXPECT_EQ("18446744073709551615", show(UINT64_MAX));
+  EXPECT_EQ("-9223372036854775808", show(INT64_MIN));
+  EXPECT_EQ("x", show('x'));
+  EXPECT_EQ("0.1", show(0.1));
+  EXPECT_EQ("0.1", show(0.1f));
+  EXPECT_EQ("-2.5", show(-2.5));
+  EXPECT_EQ("1e+300", show(1e300));
+
+  let doubles = fp::uniformN(1000, -1e6, 1e6, 7);
+  std::for_each(extent(doubles), [](double d) {
+    EXPECT_EQ(d, strtod(show(d).c_str(), nullptr));
+  });
+
+  let ints = fp::increasingN(5, -2);
+  EXPECT_EQ("[-2, -1, 0, 1, 2]", show(ints));
+  EXPECT_LE(show(ints).size(), fp::showSize(ints));
+  EXPECT_EQ(6u, fp::showSize(-12345));
+  EXPECT_EQ("[[1, 2],\n[3]]\n", show(fp::types<fp::types<int>::list>::list({ {1, 2}, {3} })));
+  EXPECT_EQ("[a, bc]", show(fp::types<std::string>::list({ "a", "bc" })));
+  EXPECT_EQ("", show(fp::types<int>::list()));
+  EXPECT_EQ("1 2 3", fp::concat(fp::increasingN(3, 1)));
+}
+
+TEST(Prelude, Read) {
+  using fp::read;
+  using fp::string_ref;
+
+  EXPECT_EQ(fp::just(42), read<int>("42"));
+  EXPECT_EQ(fp::just(-17), read<int>(" -17\n"));
+  EXPECT_EQ(fp::just(123), read<int>("000000000000000000000000123"));
+  EXPECT_EQ(fp::just(1234567890123456789LL), read<long long>("1234567890123456789"));
+  EXPECT_EQ(fp::just(INT64_MIN), read<int64_t>("-9223372036854775808"));
+  EXPECT_EQ(fp::just(UINT64_MAX), read<uint64_t>("18446744073709551615"));
+  EXPECT_TRUE(isNothing(read<uint64_t>("18446744073709551616")));
+  EXPECT_TRUE(isNothing(read<int64_t>("9223372036854775808")));
+  EXPECT_TRUE(isNothing(read<uint8_t>("256")));
+  EXPECT_TRUE(isNothing(read<unsigned>("-1")));
+  EXPECT_TRUE(isNothing(read<int>("12a")));
+  EXPECT_TRUE(isNothing(read<int>("1 2")));
+  EXPECT_TRUE(isNothing(read<int>("")));
+  EXPECT_TRUE(isNothing(read<int>("-")));
+
+  EXPECT_EQ(fp::just(0.1), read<double>("0.1"));
+  EXPECT_EQ(fp::just(0.1f), read<float>("0.1"));
+  EXPECT_EQ(fp::just(-2.5e-3), read<double>("-2.5E-3"));
+  EXPECT_EQ(fp::just(3.141592653589793238), read<double>("3.14159265358979323846264338"));
+  EXPECT_EQ(fp::just(1e300), read<double>("1e300"));
+  EXPECT_EQ(fp::just(5.0), read<double>("5."));
+  EXPECT_TRUE(fp::fromJust(read<double>("inf")) > 1e308);
+  EXPECT_TRUE(isNothing(read<double>("1e400")));
+  EXPECT_TRUE(isNothing(read<double>("-1e400")));
+  EXPECT_TRUE(isNothing(read<float>("1e39")));
+  EXPECT_EQ(fp::just(0.0), read<double>("1e-400"));
+  EXPECT_TRUE(isNothing(read<double>("1e")));
+  EXPECT_TRUE(isNothing(read<double>("0x10")));
+  EXPECT_TRUE(isNothing(read<double>(".")));
+
+  let doubles = fp::uniformN(2000, -1e6, 1e6, 11);
+  std::for_each(extent(doubles), [](double d) {
+    EXPECT_EQ(d, fp::fromJust(read<double>(fp::show(d))));
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.6e", d);
+    EXPECT_EQ(strtod(buf, nullptr), fp::fromJust(read<double>(buf)));
+    snprintf(buf, sizeof(buf), "%.4f", d);
+    EXPECT_EQ(strtof(buf, nullptr), fp::fromJust(read<float>(buf)));
+  });
+
+  const std::string text("1 22\n-333\t4444  \n55555");
+  let tokens = fp::words(string_ref(text));
+  EXPECT_EQ(string_ref("22\n-333\t4444"), tokens[1]);
+  let rows = fp::lines(string_ref(text));
+  EXPECT_EQ(3u, rows.size());
+  EXPECT_EQ(fp::just(55555), read<int>(rows[2]));
+  EXPECT_EQ(fp::types<int>::list({ 1, 22, -333, 4444, 55555 }), fp::fromJust(fp::readAll<int>(text)));
+  EXPECT_TRUE(isNothing(fp::readAll<int>("1 x 3")));
+
+  let ints = fp::uniformN(50000, -1000000, 1000000, 3);
+  std::stringstream ss(fp::concat(ints, "\n"));
+  EXPECT_EQ(ints, fp::fromJust(fp::readAll<int>(ss, 4096)));
+}
+
+TEST(Prelude, Csv) {
+  using fp::types;
+
+  let table = fp::readCsv("id,name,price\r\n1,apple,0.5\r\n2,\"pear, green\",1.25\n\n3,\"say \"\"hi\"\"\nthere\",2\n4\n");
+  EXPECT_EQ(types<std::string>::list({ "id", "name", "price" }), table.names());
+  EXPECT_EQ(4u, table.rows());
+  EXPECT_EQ(types<int>::list({ 1, 2, 3, 4 }), fp::fromJust(table.column<int>("id")));
+  EXPECT_EQ(types<std::string>::list({ "apple", "pear, green", "say \"hi\"\nthere", "" }),
+            fp::fromJust(table.column<std::string>(1)));
+  EXPECT_TRUE(isNothing(table.column<double>("price")));
+  EXPECT_TRUE(isNothing(table.column<int>("missing")));
+  EXPECT_EQ(fp::string_ref("1.25"), table.fields(2)[1]);
+
+  let tsv = fp::readCsv("1\t2\n3\t4", fp::csv_options('\t', false));
+  EXPECT_TRUE(tsv.names().empty());
+  EXPECT_EQ(types<double>::list({ 2, 4 }), fp::fromJust(tsv.column<double>(1)));
+  let flags = fp::fromJust(fp::readCsv(fp::concat(fp::map([](int i) { return fp::show(i % 2) + "\n"; },
+                                                           fp::increasingN(100000, 0))),
+                                        fp::csv_options(',', false)).column<bool>(0));
+  EXPECT_EQ(fp::map([](int i) { return i % 2 == 1; }, fp::increasingN(100000, 0)), flags);
+
+  // Without a header the first record is a row, unescaped once
+  let headless = fp::readCsv("\"a\"\"b\",x\nc,y\n", fp::csv_options(',', false));
+  EXPECT_EQ(types<std::string>::list({ "a\"b", "c" }), fp::fromJust(headless.column<std::string>(0)));
+  std::stringstream headlessStream("\"a\"\"b\",x\nc,y\n");
+  fp::csv_reader headlessReader(headlessStream, fp::csv_options(',', false));
+  EXPECT_EQ(types<std::string>::list({ "a\"b", "c" }),
+            fp::fromJust(fp::fromJust(headlessReader.next()).column<std::string>(0)));
+
+  // Several chunks, with quoted newlines and delimiters straddling them,
+  // and quotes inside unquoted fields, which are not special
+  std::string text("n,label,x\n");
+  const size_t rows = 60000;
+  for (size_t i = 0; i < rows; ++i) {
+    text += fp::show(i);
+    text += i % 3 ? ",\"a,\"\"b\"\"\nc\"," : ",5\" plain,";
+    text += fp::show(i * 0.5);
+    text += '\n';
+  }
+  EXPECT_GT(text.size(), (size_t)FP_CSV_CHUNK);
+  let big = fp::readCsv(text);
+  EXPECT_EQ(fp::increasingN(rows, 0), fp::fromJust(big.column<int>("n")));
+  EXPECT_EQ("a,\"b\"\nc", big.fields(1)[rows - 1].str());
+  EXPECT_EQ("5\" plain", big.fields(1)[0].str());
+  let x = fp::fromJust(big.column<double>("x"));
+  EXPECT_EQ(rows * (rows - 1) * 0.25, fp::foldl([](double a, double b) { return a + b; }, 0.0, x));
+
+  std::stringstream ss(text);
+  fp::csv_reader reader(ss, fp::csv_options(), 100000);
+  size_t batches = 0, seen = 0;
+  while (let batch = reader.next()) {
+    let n = fp::fromJust((*batch).column<int>(0));
+    EXPECT_EQ(fp::increasingN(n.size(), (int)seen), n);
+    EXPECT_EQ(reader.names(), (*batch).names());
+    seen += n.size();
+    ++batches;
+  }
+  EXPECT_EQ(rows, seen);
+  EXPECT_GT(batches, 10u);
+}
+
+TEST(IO, FileOperations) {
+  const std::string src("fp_io_test_src.tmp"), dst("fp_io_test_dst.tmp"), moved("fp_io_test_moved.tmp");
+  const std::string contents = fp::concat(fp::increasingN(100000, 0));
+  {
+    std::ofstream ofs(src, std::ios::binary);
+    ofs << contents;
+  }
+  EXPECT_TRUE(fp::doesFileExist(src));
+  EXPECT_FALSE(fp::doesFileExist(dst));
+  EXPECT_EQ(contents.size(), fp::fileSize(src));
+
+  EXPECT_TRUE(fp::copyFile(src, dst));
+  EXPECT_EQ(contents.size(), fp::fileSize(dst));
+  std::ifstream copied(dst, std::ios::binary);
+  EXPECT_EQ(contents, std::string(std::istreambuf_iterator<char>(copied), std::istreambuf_iterator<char>()));
+  copied.close();
+
+  // Onto itself fails without truncating it; onto an existing file replaces it
+  EXPECT_FALSE(fp::copyFile(src, src));
+  EXPECT_FALSE(fp::copyFile(src, "./" + src));
+  EXPECT_EQ(contents.size(), fp::fileSize(src));
+  std::ofstream(dst, std::ios::binary) << "old";
+  EXPECT_TRUE(fp::copyFile(src, dst));
+  EXPECT_EQ(contents.size(), fp::fileSize(dst));
+
+  EXPECT_TRUE(fp::moveFile(dst, moved));
+  EXPECT_FALSE(fp::doesFileExist(dst));
+  EXPECT_EQ(contents.size(), fp::fileSize(moved));
+  EXPECT_FALSE(fp::copyFile("fp_io_test_missing.tmp", dst));
+  EXPECT_FALSE(fp::doesFileExist(dst));
+  std::ofstream(dst, std::ios::binary) << "old";
+  EXPECT_FALSE(fp::copyFile("fp_io_test_missing.tmp", dst));
+  EXPECT_EQ(3u, fp::fileSize(dst));
+  EXPECT_TRUE(fp::removeFile(dst));
+
+  EXPECT_TRUE(fp::removeFile(src));
+  EXPECT_TRUE(fp::removeFile(moved));
+  EXPECT_FALSE(fp::doesFileExist(src));
+  EXPECT_EQ(0u, fp::fileSize(src));
+}
+
+TEST(IO, ApplyFileOps) {
+  const fp::io_backend backends[] = { fp::IO_AUTO, fp::IO_THREADS };
+  for (size_t b = 0; b < 2; ++b) {
+    const size_t n = 200;
+    let name = [](const char* prefix, size_t i) { return std::string(prefix) + fp::show(i) + ".tmp"; };
+    fp::types<fp::file_op>::list creates, copies, moves, removes;
+    for (size_t i = 0; i < n; ++i) {
+      std::ofstream(name("fp_batch_a", i)) << i;
+      copies.push_back(fp::copyOp(name("fp_batch_a", i), name("fp_batch_b", i)));
+      moves.push_back(i % 2 ? fp::moveOp(name("fp_batch_a", i), name("fp_batch_c", i))
+                            : fp::renameOp(name("fp_batch_a", i), name("fp_batch_c", i)));
+      removes.push_back(fp::removeOp(name("fp_batch_b", i)));
+      removes.push_back(fp::removeOp(name("fp_batch_c", i)));
+    }
+    removes.push_back(fp::removeOp("fp_batch_missing.tmp"));
+
+    EXPECT_TRUE(fp::all(fp::istrue, fp::applyFileOps(copies, backends[b])));
+    EXPECT_TRUE(fp::all(fp::istrue, fp::applyFileOps(moves, backends[b])));
+    EXPECT_FALSE(fp::doesFileExist(name("fp_batch_a", 7)));
+    EXPECT_EQ(fp::show(7u).size(), fp::fileSize(name("fp_batch_c", 7)));
+    EXPECT_EQ(fp::show(123u).size(), fp::fileSize(name("fp_batch_b", 123)));
+
+    let removed = fp::applyFileOps(removes, backends[b]);
+    EXPECT_EQ(2 * n + 1, removed.size());
+    EXPECT_TRUE(fp::all(fp::istrue, fp::take(2 * n, removed)));
+    EXPECT_FALSE(removed.back());
+    EXPECT_FALSE(fp::doesFileExist(name("fp_batch_c", 7)));
+  }
+}
+
+TEST(IO, WalkDirectory) {
+  const std::string root("fp_walk_test");
+  fp::types<std::string>::list dirs, files;
+  dirs.push_back(root);
+  for (int i = 0; i < 3; ++i) {
+    dirs.push_back(root + "/d" + fp::show(i));
+    for (int j = 0; j < 3; ++j)
+      dirs.push_back(root + "/d" + fp::show(i) + "/e" + fp::show(j));
+  }
+  for (size_t d = 0; d < dirs.size(); ++d) {
+    EXPECT_TRUE(fp::createDirectory(dirs[d]));
+    for (int k = 0; k < 40; ++k) {
+      files.push_back(dirs[d] + "/f" + fp::show(k) + (k % 4 ? ".mp3" : ".txt"));
+      std::ofstream(files.back()) << std::string(k, 'x');
+    }
+  }
+
+  let top = fp::list(fp::listDirectory(root));
+  EXPECT_EQ(43u, top.size());
+
+  let all = fp::list(fp::walkDirectory(root, fp::walk_options(true, 4)));
+  EXPECT_EQ(dirs.size() - 1 + files.size(), all.size());
+  let paths = fp::list(fp::map(&fp::entryPath, fp::fromList(all)));
+  EXPECT_TRUE(fp::all([&](const std::string& f) { return std::find(extent(paths), f) != end(paths); }, files));
+  std::for_each(extent(all), [](const fp::dir_entry& e) {
+    if (e.type == fp::FILE_REGULAR)
+      EXPECT_EQ(fp::fileSize(e.path), e.size);
+    else
+      EXPECT_EQ(fp::FILE_DIRECTORY, e.type);
+  });
+
+  let isMp3 = [](const std::string& f) { return f.size() > 4 && f.compare(f.size() - 4, 4, ".mp3") == 0; };
+  let mp3s = fp::list(fp::filter(isMp3, fp::map(&fp::entryPath, fp::walkDirectory(root))));
+  EXPECT_EQ(files.size() * 3 / 4, mp3s.size());
+
+  // Abandoning a walk early must not hang
+  EXPECT_EQ(5u, fp::list(fp::take(5, fp::walkDirectory(root, fp::walk_options(false, 2)))).size());
+  EXPECT_TRUE(fp::list(fp::walkDirectory("fp_walk_test_missing")).empty());
+
+  std::for_each(extent(files), [](const std::string& f) { fp::removeFile(f); });
+  std::for_each(dirs.rbegin(), dirs.rend(), [](const std::string& d) { EXPECT_TRUE(fp::removeFile(d)); });
+}
+
+TEST(Prelude, PathMatch) {
+  using fp::types;
+
+  let songs = fp::extensionSet(types<std::string>::list({ "mp3", ".flac", "OGG", "longextension" }));
+  EXPECT_TRUE(songs("/music/a.mp3"));
+  EXPECT_TRUE(songs("b.MP3"));
+  EXPECT_TRUE(songs("c.ogg"));
+  EXPECT_TRUE(songs("d.flac"));
+  EXPECT_TRUE(songs("e.longextension"));
+  EXPECT_FALSE(songs("mp3"));
+  EXPECT_FALSE(songs("f.mp4"));
+  EXPECT_FALSE(songs("g.mp"));
+  EXPECT_FALSE(songs("h.mp3x"));
+  EXPECT_FALSE(songs("dir.mp3/file"));
+  EXPECT_FALSE(fp::extensionSet("mp3", false)("a.MP3"));
+  EXPECT_FALSE(fp::extension_set()("a.mp3"));
+
+  let paths = fp::types<std::string>::list({ "/music/x.mp3", "music/x.mp3", "music/a/x.mp3", "track01.wav",
+                                             "track1.wav", "apple.ogg", "zebra.ogg", "*.txt", "a.txt", "Song.MP3" });
+  let matching = [&](const fp::glob_set& g) { return fp::filter(g, paths); };
+  EXPECT_EQ(types<std::string>::list({ "/music/x.mp3", "music/x.mp3", "music/a/x.mp3" }), matching(fp::globSet("*.mp3")));
+  EXPECT_EQ(types<std::string>::list({ "music/x.mp3" }), matching(fp::globSet("music/*.mp3")));
+  EXPECT_EQ(types<std::string>::list({ "music/x.mp3", "music/a/x.mp3" }), matching(fp::globSet("music/**.mp3")));
+  EXPECT_EQ(types<std::string>::list({ "track01.wav" }), matching(fp::globSet("track??.wav")));
+  EXPECT_EQ(types<std::string>::list({ "apple.ogg" }), matching(fp::globSet("[a-c]*.ogg")));
+  EXPECT_EQ(types<std::string>::list({ "zebra.ogg" }), matching(fp::globSet("[!a-c]*.ogg")));
+  EXPECT_EQ(types<std::string>::list({ "*.txt" }), matching(fp::globSet("\\*.txt")));
+  EXPECT_EQ(types<std::string>::list({ "/music/x.mp3", "music/x.mp3", "music/a/x.mp3", "Song.MP3" }), matching(fp::globSet("*.mp3", true)));
+  EXPECT_EQ(types<std::string>::list({ "track1.wav", "*.txt", "a.txt" }),
+            matching(fp::globSet(types<std::string>::list({ "track?.wav", "?.txt" }))));
+  EXPECT_TRUE(matching(fp::glob_set()).empty());
+
+  // Against std::regex on random names
+  std::regex songRegex("^.*.\\.(mp3|flac|ogg|longextension)$", std::regex::icase);
+  let chars = std::string("aMP3.fLoGg/");
+  for (int i = 0; i < 2000; ++i) {
+    std::string name;
+    let picks = fp::uniformN(8, 0, (int)chars.size() - 1, i);
+    std::for_each(extent(picks), [&](int c) { name.push_back(chars[c]); });
+    name += i % 2 ? ".mp3" : "";
+    const bool slashFree = fp::fileNameOf(name).size() == name.size();
+    if (slashFree) {
+      EXPECT_EQ(std::regex_match(name, songRegex), songs(name)) << name;
+    }
+  }
+}
+
+TEST(IO, MappedFile) {
+  const std::string path("fp_mapped_test.tmp");
+  const size_t page = 4096;
+  const size_t sizes[] = { 0, 10, page, 16 * page, 16 * page + 1 };
+  for (size_t i = 0; i < 5; ++i) {
+    std::string contents(sizes[i], 'x');
+    for (size_t j = 0; j < contents.size(); ++j)
+      contents[j] = (char)('a' + j % 26);
+    std::ofstream(path, std::ios::binary) << contents;
+
+    fp::mapped_file file(path, true);
+    ASSERT_TRUE(file.valid());
+    EXPECT_EQ(contents.size(), file.size());
+    EXPECT_EQ(contents, file.text().str());
+    EXPECT_EQ('\0', file.data()[file.size()]);
+
+    // Writes stay in memory
+    if (file.size() > 0) {
+      file.data()[0] = '#';
+      std::ifstream ifs(path, std::ios::binary);
+      EXPECT_EQ('a', ifs.get());
+    }
+
+    fp::mapped_file moved(std::move(file));
+    EXPECT_FALSE(file.valid());
+    EXPECT_EQ(contents.size(), moved.size());
+  }
+  EXPECT_TRUE(fp::removeFile(path));
+  EXPECT_FALSE(fp::mapped_file(path).valid());
+}
+
+TEST(IO, WriteLines) {
+  const std::string path("fp_write_test.tmp");
+  let contents = [&]() {
+    std::ifstream ifs(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  };
+
+  fp::types<std::string>::list lines;
+  for (size_t i = 0; i < 20000; ++i)
+    lines.push_back(fp::show(i));
+  lines.push_back(std::string(5000, 'x'));
+  lines.push_back("");
+  std::string expected;
+  for (size_t i = 0; i < lines.size(); ++i)
+    expected.append(lines[i]).push_back('\n');
+
+  EXPECT_TRUE(fp::writeLines(path, lines));
+  EXPECT_EQ(expected, contents());
+
+  // Small blocks, so long lines skip the copy and the writer thread cycles
+  for (size_t background = 0; background < 2; ++background) {
+    EXPECT_TRUE(fp::writeLines(path, lines, fp::write_options(background != 0, 4096)));
+    EXPECT_EQ(expected, contents());
+  }
+
+  const std::string text = lines[0] + lines[1] + lines[2];
+  EXPECT_TRUE(fp::writeLines(path, fp::take(2, fp::fromList(fp::words(fp::string_ref("a bb ccc"))))));
+  EXPECT_EQ("a\nbb\n", contents());
+  EXPECT_TRUE(fp::writeFile(path, text));
+  EXPECT_EQ("012", contents());
+
+  EXPECT_FALSE(fp::writeFile("fp_missing_dir/fp_write_test.tmp", text));
+  EXPECT_TRUE(fp::removeFile(path));
+}
+
+TEST(IO, ReadLines) {
+  const std::string path("fp_read_test.tmp");
+  fp::types<std::string>::list lines;
+  for (size_t i = 0; i < 3000; ++i)
+    lines.push_back(std::string(i % 97, (char)('a' + i % 26)));
+  lines.push_back(std::string(10000, 'z'));
+  lines.push_back("last");
+  std::string text;
+  for (size_t i = 0; i < lines.size(); ++i)
+    text.append(lines[i]).push_back('\n');
+  text.pop_back();
+  ASSERT_TRUE(fp::writeFile(path, text));
+
+  let copy = [](fp::stream<fp::string_ref> s) {
+    return fp::list(fp::map([](const fp::string_ref& line) { return line.str(); }, s));
+  };
+  const size_t blockSizes[] = { 7, 16, 4096, 1 << 20 };
+  for (size_t b = 0; b < 4; ++b) {
+    EXPECT_EQ(lines, copy(fp::readLines(path, fp::read_options(false, blockSizes[b]))));
+    EXPECT_EQ(lines, copy(fp::readLines(path, fp::read_options(true,  blockSizes[b]))));
+  }
+
+  FILE* file = fopen(path.c_str(), "rb");
+  ASSERT_TRUE(file != nullptr);
+  EXPECT_EQ(fp::take(3, lines), copy(fp::take(3, fp::readLines(file))));
+  fclose(file);
+
+  // list copies the lines out of the blocks they were read into
+  EXPECT_EQ(lines, fp::list(fp::readLines(path, fp::read_options(true, 16))));
+
+  ASSERT_TRUE(fp::writeFile(path, "\na\n\n"));
+  EXPECT_EQ(fp::types<std::string>::list({ "", "a", "" }), copy(fp::readLines(path)));
+  EXPECT_TRUE(fp::removeFile(path));
+  EXPECT_TRUE(copy(fp::readLines(path)).empty());
+}
+
+TEST(Prelude, StringList) {
+  using fp::string_list;
+  const std::string text("pear\napple\n\nfig\napple\npineapple\npineapples\n");
+  const string_list l = fp::packedLines(text);
+  EXPECT_EQ(7u, l.size());
+  EXPECT_EQ(fp::string_ref("apple"), l[1]);
+  EXPECT_EQ("", l[2].str());
+  EXPECT_EQ("pineapples", fp::last(l));
+  EXPECT_EQ(fp::types<std::string>::list({ "a", "", "b" }), fp::types<std::string>::list(fp::split(std::string("a,,b,"), ',')));
+
+  let sorted = fp::sort(l);
+  EXPECT_EQ(string_list({ "", "apple", "apple", "fig", "pear", "pineapple", "pineapples" }), sorted);
+  EXPECT_EQ(fp::sort(fp::types<std::string>::list(l)), fp::types<std::string>::list(sorted));
+  EXPECT_EQ(string_list({ "fig", "pear" }), fp::filter([](const std::string& s) { return s.size() == 3 || s[0] == 'p'; }, fp::take(5, sorted)));
+  EXPECT_EQ(string_list({ "fig" }), fp::filter([](const fp::string_ref& s) { return s.size() == 3; }, sorted));
+  EXPECT_EQ(6u, fp::group(sorted).size());
+  EXPECT_EQ(string_list({ "apple", "apple" }), fp::group(sorted)[1]);
+
+  EXPECT_EQ(fp::types<size_t>::list({ 4, 5, 0, 3, 5, 9, 10 }), fp::map([](const std::string& s) { return s.size(); }, l));
+  EXPECT_EQ(string_list({ "pear", "apple", "x" }), fp::concat(fp::take(2, l), string_list({ "x" })));
+  EXPECT_EQ(string_list({ "c", "b", "a" }), fp::reverse(fp::packedWords(std::string("a b c"))));
+  EXPECT_EQ("a b c", fp::concat(fp::packedWords(std::string("a b c"))));
+
+  // lines, words and split on a string still give a list of strings
+  const std::string s("b c a");
+  for (auto& w : fp::words(s))
+    w += "!";
+  EXPECT_EQ(1u, begin(fp::words(s))->size());
+  EXPECT_EQ(fp::types<std::string>::list({ "c", "b", "a" }),
+            fp::sortBy([](const std::string& a, const std::string& b) { return a > b; }, fp::words(s)));
+  std::string first = fp::lines(text)[0];
+  EXPECT_EQ("pear", first);
+}
+
+TEST(Prelude, Intern) {
+  // Threads racing to intern overlapping strings through several growths
+  let table = std::make_shared<fp::symbol_table>(1);
+  const size_t threads = 8, n = 5000;
+  std::vector< fp::types<fp::symbol>::list > seen(threads);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      for (size_t i = 0; i < n; ++i)
+        seen[t].push_back(table->intern(fp::show((i * 7 + t * 1000) % n)));
+    }));
+  }
+  for (size_t t = 0; t < threads; ++t)
+    workers[t].join();
+  EXPECT_EQ(n, table->size());
+  for (size_t t = 0; t < threads; ++t) {
+    for (size_t i = 0; i < n; ++i)
+      EXPECT_EQ(fp::show((i * 7 + t * 1000) % n), (*table)[seen[t][i]].str());
+  }
+  EXPECT_EQ(fp::just(seen[0][3]), table->find(fp::show(21u)));
+  EXPECT_FALSE(table->find("missing"));
+
+  const std::string text("b a c a b a");
+  let l = fp::encode(fp::words(fp::string_ref(text)));
+  EXPECT_EQ(3u, l.table()->size());
+  EXPECT_EQ(fp::types<fp::symbol>::list({ 0, 1, 2, 1, 0, 1 }), l.symbols());
+  EXPECT_EQ("c", l[2].str());
+  EXPECT_EQ(fp::types<std::string>::list({ "a", "a", "a", "b", "b", "c" }), fp::types<std::string>::list(fp::sort(l)));
+  EXPECT_EQ(3u, fp::group(fp::sort(l)).size());
+  fp::symbol_list other;
+  other.push_back("a");
+  other.push_back("b");
+  EXPECT_EQ(other, fp::reverse(fp::encode(fp::take(2, fp::words(text)), l.table())));
+  EXPECT_NE(other, fp::encode(fp::take(2, fp::words(text)), l.table()));
+  EXPECT_TRUE(fp::elem("c", l));
+  EXPECT_FALSE(fp::elem("d", l));
+  typedef std::pair<std::string, size_t> count;
+  EXPECT_EQ(fp::types<count>::list({ count("b", 2), count("a", 3), count("c", 1) }), fp::frequencies(l));
+}
+
+TEST(Prelude, Rope) {
+  using fp::rope;
+  // Prepending and appending a char at a time against a plain string
+  rope r;
+  std::string s;
+  for (size_t i = 0; i < 5000; ++i) {
+    const char c = (char)('a' + i % 26);
+    if (i % 3 == 0) { r = fp::cons(c, r);   s.insert(0, 1, c); }
+    else            { r = fp::append(r, c); s.push_back(c); }
+  }
+  EXPECT_EQ(s.size(), r.size());
+  EXPECT_EQ(s, r.str());
+  EXPECT_EQ(s[1234], r[1234]);
+  EXPECT_EQ(s.substr(100, 3000), r.substr(100, 3000).str());
+  EXPECT_EQ(s.substr(4990), r.substr(4990).str());
+  EXPECT_TRUE(r.substr(5000).empty());
+
+  const rope big = fp::concat(r, fp::concat(rope(s), r.substr(7, 500)));
+  EXPECT_EQ(s + s + s.substr(7, 500), big.str());
+  EXPECT_EQ(big.str(), big.flatten().str());
+  EXPECT_EQ(big, big.flatten());
+
+  const rope hello = rope("hello") + rope(", ") + fp::cons(rope("wor"), rope("ld"));
+  EXPECT_EQ("hello, world", fp::show(hello));
+  EXPECT_EQ("hello, world!", fp::concat(fp::types<rope>::list({ hello, rope("!") }), ""));
+  EXPECT_EQ("[a, bc]", fp::show(fp::types<rope>::list({ rope("a"), rope("bc") })));
+
+  // Literals still go to the string overloads
+  EXPECT_EQ("abc", fp::cons('a', "bc"));
+  fp::putStr("");
+  fp::putStrLen("");
+}
+
+TEST(Prelude, KeywordSet) {
+  using fp::types;
+  let logs = types<std::string>::list({ "ok: started", "warn: disk at 91%", "ERROR: lost", "fatal error", "", "she sells" });
+  let problems = fp::keywordSet(types<std::string>::list({ "error", "fatal", "warn" }));
+  EXPECT_EQ(types<std::string>::list({ "warn: disk at 91%", "fatal error" }), fp::filter(problems, logs));
+  EXPECT_EQ(types<std::string>::list({ "warn: disk at 91%", "ERROR: lost", "fatal error" }),
+            fp::filter(fp::keywordSet(types<std::string>::list({ "error", "fatal", "warn" }), true), logs));
+  EXPECT_FALSE(fp::keyword_set()("anything"));
+  EXPECT_TRUE(fp::keywordSet("%")("91%"));
+
+  // Overlapping keywords, reported by end position
+  let ushers = fp::keywordSet(types<std::string>::list({ "he", "she", "his", "hers" }));
+  let found = ushers.find("ushers");
+  ASSERT_EQ(3u, found.size());
+  EXPECT_EQ(1u, found[0].position); EXPECT_EQ(1u, found[0].pattern);
+  EXPECT_EQ(2u, found[1].position); EXPECT_EQ(0u, found[1].pattern);
+  EXPECT_EQ(2u, found[2].position); EXPECT_EQ(3u, found[2].pattern);
+  EXPECT_EQ(types<size_t>::list({ 0, 0, 0, 0, 0, 2 }),
+            fp::map([](const types<fp::keyword_set::match>::list& m) { return m.size(); }, fp::map(ushers.positions(), logs)));
+
+  // Keywords using every byte value, each its own class
+  types<std::string>::list pairs;
+  for (int b = 0; b < 256; ++b)
+    pairs.push_back(std::string(2, (char)b));
+  let everyByte = fp::keywordSet(pairs);
+  EXPECT_TRUE(everyByte(std::string("\x01\xff\xff")));
+  EXPECT_FALSE(everyByte(std::string("\xfe\xff\x00", 3)));
+  let doubled = everyByte.find(std::string("ab\xff\xff" "ba\x00\x00", 8));
+  ASSERT_EQ(2u, doubled.size());
+  EXPECT_EQ(255u, doubled[0].pattern);
+  EXPECT_EQ(0u,   doubled[1].pattern);
+
+  // Against std::string::find over random text, including long runs with
+  // no keyword start for the SSE2 skip
+  const std::string alphabet = "abcab";
+  let keywords = types<std::string>::list({ "abc", "bca", "cab", "aa", "c", "abcabc", "zq" });
+  let set = fp::keywordSet(keywords);
+  std::string text;
+  for (size_t i = 0; i < 2000; ++i)
+    text += (i % 97 == 0) ? std::string(40, '.') : std::string(1, alphabet[(i * 7919) % alphabet.size()]);
+  text += "zq";
+  size_t expected = 0;
+  for (size_t k = 0; k < keywords.size(); ++k) {
+    for (size_t p = text.find(keywords[k]); p != std::string::npos; p = text.find(keywords[k], p + 1))
+      ++expected;
+  }
+  let all = set.find(text);
+  EXPECT_EQ(expected, all.size());
+  for (size_t i = 0; i < all.size(); ++i)
+    EXPECT_EQ(keywords[all[i].pattern], text.substr(all[i].position, keywords[all[i].pattern].size()));
+}
+
+TEST(Prelude, Memoize) {
+  size_t calls = 0;
+  let slowSquare = fp::memoize([&](int x) { ++calls; return x * x; });
+  let squares = fp::map(slowSquare, fp::types<int>::list({ 3, 1, 3, 2, 1, 3 }));
+  EXPECT_EQ(fp::types<int>::list({ 9, 1, 9, 4, 1, 9 }), squares);
+  EXPECT_EQ(3u, calls);
+  EXPECT_EQ(3u, slowSquare.hits());
+  EXPECT_EQ(3u, slowSquare.misses());
+  EXPECT_EQ(3u, slowSquare.size());
+
+  let join = fp::memoize([](const std::string& a, int n) { return a + fp::show(n); });
+  EXPECT_EQ("a1", join("a", 1));
+  EXPECT_EQ("a2", join(std::string("a"), 2));
+  EXPECT_EQ("a1", join("a", 1));
+  EXPECT_EQ(1u, join.hits());
+
+  // Bounded, and hammered from several threads with a skewed key mix
+  std::atomic<size_t> computed(0);
+  let bounded = fp::memoize([&](int x) { computed.fetch_add(1); return fp::show(x); }, 64);
+  std::vector<std::thread> workers;
+  std::atomic<bool> wrong(false);
+  for (int t = 0; t < 8; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      for (int i = 0; i < 20000; ++i) {
+        const int x = (i % 10 == 0) ? (i * 31 + t) % 5000 : i % 16;
+        if (bounded(x) != fp::show(x)) wrong.store(true);
+      }
+    }));
+  }
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  EXPECT_FALSE(wrong.load());
+  EXPECT_LE(bounded.size(), 64u + 16u);
+  EXPECT_EQ(160000u, bounded.hits() + bounded.misses());
+  EXPECT_GT(bounded.hits(), 100000u);
+}
+
+TEST(Prelude, Lazy) {
+  std::atomic<int> evaluations(0);
+  let answer = fp::delay([&]() { evaluations.fetch_add(1); return std::string("42"); });
+  EXPECT_FALSE(answer.evaluated());
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 8; ++t)
+    workers.push_back(std::thread([&]() { EXPECT_EQ("42", *answer); }));
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  EXPECT_TRUE(answer.evaluated());
+  EXPECT_EQ(2u, answer->size());
+  EXPECT_EQ(1, evaluations.load());
+
+  // Each element defined by the ones before it, computed once
+  size_t calls = 0;
+  const fp::lazy_list<uint64_t> fibs = fp::tabulate([&](const fp::lazy_list<uint64_t>& fibs, size_t i) {
+    ++calls;
+    return i < 2 ? (uint64_t)i : fibs[i - 1] + fibs[i - 2];
+  });
+  EXPECT_EQ(2880067194370816120ULL, fp::index(90, fibs));
+  EXPECT_EQ(55u, fibs[10]);
+  EXPECT_EQ(fp::types<uint64_t>::list({ 0, 1, 1, 2, 3, 5, 8 }), fp::take(7, fibs));
+  EXPECT_EQ(fp::types<uint64_t>::list({ 13, 21, 34 }), fp::takeWhile([](uint64_t x) { return x < 50; }, fp::drop(7, fibs)));
+  EXPECT_EQ(91u, calls);
+  EXPECT_EQ(fp::types<uint64_t>::list({ 1, 2, 3, 5 }), fp::take(4, fp::zipWith(std::plus<uint64_t>(), fibs, fp::tail(fibs))));
+
+  // A generator consumed once, however many traversals
+  size_t generated = 0;
+  std::function<int()> counter = [&]() { return (int)generated++; };
+  let naturals = fp::lazyList(counter);
+  EXPECT_EQ(fp::types<int>::list({ 0, 1, 2 }), fp::take(3, naturals));
+  EXPECT_EQ(fp::types<int>::list({ 0, 1, 2, 3 }), fp::take(4, naturals));
+  EXPECT_EQ(4u, generated);
+
+  // Finite, from a stream
+  let squares = fp::map([](int x) { return x * x; }, fp::lazyList(fp::fromList(fp::types<int>::list({ 1, 2, 3 }))));
+  int sum = 0;
+  for (let it = squares.begin(); it != squares.end(); ++it)
+    sum += *it;
+  for (let it = squares.begin(); it != squares.end(); ++it)
+    sum += *it;
+  EXPECT_EQ(28, sum);
+  EXPECT_FALSE(squares.has(3));
+  EXPECT_THROW(squares[3], std::out_of_range);
+  EXPECT_TRUE(fp::drop(3, squares).empty());
+
+  // Readers racing over one list see each element computed once
+  std::atomic<size_t> computed(0);
+  const fp::lazy_list<size_t> triangles = fp::tabulate([&](const fp::lazy_list<size_t>& t, size_t i) {
+    computed.fetch_add(1);
+    return i == 0 ? (size_t)0 : t[i - 1] + i;
+  });
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r < 4; ++r) {
+    readers.push_back(std::thread([&, r]() {
+      for (size_t i = 0; i < 2000; ++i) {
+        const size_t j = (i * (r + 1) * 7) % 2000;
+        if (triangles[j] != j * (j + 1) / 2) computed.fetch_add(1000000);
+      }
+    }));
+  }
+  for (size_t r = 0; r < readers.size(); ++r)
+    readers[r].join();
+  EXPECT_EQ(2000u, computed.load());
+
+  const fp::lazy_list<int> loop = fp::tabulate([](const fp::lazy_list<int>& self, size_t i) { return self[i] + 1; });
+  EXPECT_THROW(loop[0], std::logic_error);
+}
+
+TEST(Prelude, Tee) {
+  // Two consumers on their own threads, a small buffer between them
+  size_t pulled = 0;
+  let source = fp::stream<int>([&]() { return pulled < 100000 ? fp::just((int)++pulled) : fp::Maybe<int>(); });
+  let branches = fp::tee(2, source, 64);
+  long long sum = 0;
+  int largest = 0;
+  std::thread summer([&]() { for (let it = branches[0].begin(); it != branches[0].end(); ++it) sum += *it; });
+  std::thread maxer([&]()  { for (let it = branches[1].begin(); it != branches[1].end(); ++it) largest = std::max(largest, *it); });
+  summer.join();
+  maxer.join();
+  EXPECT_EQ(5000050000LL, sum);
+  EXPECT_EQ(100000, largest);
+  EXPECT_EQ(100000u, pulled);
+
+  // On one thread, taking turns within the capacity
+  let copies = fp::tee(3, fp::fromList(fp::types<int>::list({ 1, 2, 3, 4, 5 })), 4);
+  EXPECT_EQ(fp::just(1), copies[0]());
+  EXPECT_EQ(fp::just(2), copies[0]());
+  EXPECT_EQ(fp::just(1), copies[1]());
+  EXPECT_EQ(fp::just(1), copies[2]());
+  fp::types<int>::list rounds;
+  for (fp::Maybe<int> a = copies[1](), b = copies[2](); a && b; a = copies[1](), b = copies[2]())
+    rounds.push_back(*a + *b);
+  EXPECT_EQ(fp::types<int>::list({ 4, 6, 8, 10 }), rounds);
+  EXPECT_EQ(fp::types<int>::list({ 3, 4, 5 }), fp::list(copies[0]));
+
+  // A dropped consumer holds nothing back
+  {
+    let pair = fp::tee(2, fp::fromList(fp::types<int>::list({ 1, 2, 3, 4 })), 1);
+    let first = pair[0];
+    pair.clear();
+    EXPECT_EQ(fp::types<int>::list({ 1, 2, 3, 4 }), fp::list(first));
+  }
+
+  // The two halves of splitAt and span, read in either order
+  let numbers = fp::types<int>::list({ 1, 2, 3, 4, 5, 6 });
+  let split = fp::splitAt(2, fp::fromList(numbers));
+  EXPECT_EQ(fp::types<int>::list({ 1, 2 }), fp::list(split.first));
+  EXPECT_EQ(fp::types<int>::list({ 3, 4, 5, 6 }), fp::list(split.second));
+  let split2 = fp::splitAt(2, fp::fromList(numbers));
+  EXPECT_EQ(fp::types<int>::list({ 3, 4, 5, 6 }), fp::list(split2.second));
+  EXPECT_EQ(fp::types<int>::list({ 1, 2 }), fp::list(split2.first));
+
+  let small = [](int x) { return x < 4; };
+  let spanned = fp::span(small, fp::fromList(numbers));
+  EXPECT_EQ(fp::types<int>::list({ 1, 2, 3 }), fp::list(spanned.first));
+  EXPECT_EQ(fp::types<int>::list({ 4, 5, 6 }), fp::list(spanned.second));
+  let spanned2 = fp::span(small, fp::fromList(numbers));
+  EXPECT_EQ(fp::just(4), spanned2.second());
+  EXPECT_EQ(fp::types<int>::list({ 1, 2, 3 }), fp::list(spanned2.first));
+  EXPECT_EQ(fp::types<int>::list({ 5, 6 }), fp::list(spanned2.second));
+
+  // splitAt does not read past the prefix it was asked for
+  size_t reads = 0;
+  let counted = fp::stream<int>([&]() { return fp::just((int)reads++); });
+  let prefix = fp::splitAt(3, counted);
+  EXPECT_EQ(fp::types<int>::list({ 0, 1, 2 }), fp::list(prefix.first));
+  EXPECT_EQ(3u, reads);
+
+  // Over a thunk, as streams each copy of the thunk counting from 0
+  int next = 0;
+  fp::thunk<int> naturals;
+  static_cast<std::function<int()>&>(naturals) = [=]() mutable { return next++; };
+  let thunkSplit = fp::splitAt(3, naturals);
+  EXPECT_EQ(fp::types<int>::list({ 3, 4 }), fp::list(fp::take(2, thunkSplit.second)));
+  EXPECT_EQ(fp::types<int>::list({ 0, 1, 2 }), fp::list(thunkSplit.first));
+  let thunkSpan = fp::span([](int x) { return x < 2; }, naturals);
+  EXPECT_EQ(fp::types<int>::list({ 0, 1 }), fp::list(thunkSpan.first));
+  EXPECT_EQ(fp::types<int>::list({ 2, 3 }), fp::list(fp::take(2, thunkSpan.second)));
+  let thunkBreak = fp::spanNot([](int x) { return x >= 2; }, naturals);
+  EXPECT_EQ(fp::types<int>::list({ 2, 3 }), fp::list(fp::take(2, thunkBreak.second)));
+  EXPECT_EQ(fp::types<int>::list({ 0, 1 }), fp::list(thunkBreak.first));
+}
+
+TEST(Prelude, Chunked) {
+  fp::types<int>::list numbers;
+  for (int i = 1; i <= 1000; ++i)
+    numbers.push_back(i);
+  let square = [](int x) { return x * x; };
+  let even   = [](int x) { return x % 2 == 0; };
+
+  // Same values as element at a time, whatever the batch size
+  for (size_t n = 1; n <= 1024; n *= 4) {
+    let squares = fp::map(square, fp::chunked(numbers, n));
+    EXPECT_EQ(fp::map(square, numbers), fp::list(squares));
+    EXPECT_EQ(fp::filter(even, numbers), fp::list(fp::filter(even, fp::chunked(numbers, n))));
+    EXPECT_EQ(500500, fp::foldl(std::plus<int>(), 0, fp::chunked(numbers, n)));
+    EXPECT_EQ(fp::types<int>::list({ 0, 1, 3, 6, 10 }), fp::list(fp::take(5, fp::scanl(std::plus<int>(), 0, fp::chunked(numbers, n)))));
+    EXPECT_EQ(fp::types<int>::list({ 1, 2, 3 }), fp::takeWhileT([](int x) { return x < 4; }, fp::chunked(numbers, n)));
+  }
+
+  // Sides in batches of different sizes
+  let sums = fp::zipWith(std::plus<int>(), fp::chunked(numbers, 7), fp::chunked(fp::fromList(numbers), 3));
+  EXPECT_EQ(fp::map([](int x) { return 2 * x; }, numbers), fp::list(sums));
+  let shorter = fp::zipWith(std::minus<int>(), fp::chunked(numbers, 16), fp::chunked(fp::types<int>::list({ 1, 1, 1 }), 2));
+  EXPECT_EQ(fp::types<int>::list({ 0, 1, 2 }), fp::list(shorter));
+
+  // scanl of nothing is its start
+  EXPECT_EQ(fp::types<int>::list({ 5 }), fp::list(fp::scanl(std::plus<int>(), 5, fp::chunked(fp::types<int>::list()))));
+
+  // Batches of bools, which vector<bool> packs
+  let isEven = fp::map(even, fp::chunked(numbers, 64));
+  let identity = [](bool b) { return b; };
+  EXPECT_EQ(fp::types<bool>::list(500, true), fp::list(fp::filter(identity, isEven)));
+  let both = fp::zipWith(std::logical_and<bool>(), fp::map(even, fp::chunked(numbers, 5)), fp::map(identity, fp::chunked(fp::map(even, numbers), 3)));
+  EXPECT_EQ(500, fp::foldl([](int n, bool b) { return n + (b ? 1 : 0); }, 0, both));
+
+  // An endless generator, in batches, and back to a stream
+  int next = 0;
+  std::function<int()> counter = [&]() { return next++; };
+  let evens = fp::unchunked(fp::filter(even, fp::chunked(counter, 64)));
+  EXPECT_EQ(fp::types<int>::list({ 0, 2, 4, 6 }), fp::list(fp::take(4, evens)));
+  EXPECT_EQ(64, next);
+}
+
+#if FP_COROUTINES
+static fp::generator<size_t> fibonacci() {
+  size_t a = 0, b = 1;
+  for (;;) {
+    co_yield a;
+    b += std::exchange(a, b);
+  }
+}
+
+static fp::generator<int> countTo(int n) {
+  for (int i = 1; i <= n; ++i)
+    co_yield i;
+}
+
+static fp::generator<int> failAfter(int n) {
+  for (int i = 0; i < n; ++i)
+    co_yield i;
+  throw std::runtime_error("source failed");
+}
+
+TEST(Prelude, Generator) {
+  EXPECT_EQ(fp::types<size_t>::list({ 0, 1, 1, 2, 3, 5, 8 }), fp::takeWhileT([](size_t x) { return x < 10; }, fibonacci()));
+  EXPECT_EQ(55u, fp::index(10, fibonacci()));
+  EXPECT_EQ(4613732u, fp::foldl(std::plus<size_t>(), (size_t)0,
+                                fp::filter([](size_t x) { return x % 2 == 0; },
+                                           fp::takeWhile([](size_t x) { return x < 4000000; }, fibonacci()))));
+
+  // Finite generators end their streams
+  EXPECT_EQ(fp::types<int>::list({ 1, 2, 3 }), fp::list(countTo(3)));
+  EXPECT_EQ(fp::types<int>::list({ 2, 4, 6 }), fp::list(fp::map([](int x) { return 2 * x; }, countTo(3))));
+  EXPECT_EQ(fp::types<int>::list({ 1, 2 }), fp::list(fp::take(5, countTo(2))));
+  EXPECT_EQ(15, fp::foldl(std::plus<int>(), 0, countTo(5)));
+  EXPECT_THROW(fp::index(5, countTo(3)), std::out_of_range);
+  EXPECT_EQ(fp::types<int>::list({ 4, 5 }), fp::list(fp::filter([](int x) { return x > 3; }, fp::chunked(countTo(5), 2))));
+
+  let squares = fp::lazyList(countTo(4));
+  EXPECT_EQ(3, squares[2]);
+  EXPECT_FALSE(squares.has(4));
+
+  EXPECT_THROW(fp::list(failAfter(2)), std::runtime_error);
+  fp::generator<int> g = countTo(2);
+  fp::generator<int> h = std::move(g);
+  EXPECT_FALSE(g.next());
+  EXPECT_TRUE(h.next());
+  EXPECT_EQ(1, h.value());
+}
+#endif
+
+TEST(Prelude, Channel) {
+  // One producer, one consumer, through a small ring
+  fp::spsc_channel<int> ring(16);
+  std::thread producer([&]() {
+    for (int i = 1; i <= 100000; ++i)
+      ring.push(i);
+    ring.close();
+  });
+  long long sum = 0;
+  int last = 0;
+  bool ordered = true;
+  for (int i; ring.pop(i); last = i) {
+    ordered = ordered && i == last + 1;
+    sum += i;
+  }
+  producer.join();
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(5000050000LL, sum);
+  EXPECT_FALSE(ring.push(1));
+
+  // Several of each, every value taken once
+  fp::mpmc_channel<int> shared(64);
+  std::atomic<long long> total(0);
+  std::atomic<int> taken(0);
+  std::vector<std::thread> producers, consumers;
+  for (int p = 0; p < 4; ++p) {
+    producers.push_back(std::thread([&, p]() {
+      for (int i = 1; i <= 25000; ++i)
+        shared.push(p * 25000 + i);
+    }));
+  }
+  for (int c = 0; c < 4; ++c) {
+    consumers.push_back(std::thread([&]() {
+      for (int i; shared.pop(i); ) {
+        total.fetch_add(i);
+        taken.fetch_add(1);
+      }
+    }));
+  }
+  for (size_t p = 0; p < producers.size(); ++p)
+    producers[p].join();
+  shared.close();
+  for (size_t c = 0; c < consumers.size(); ++c)
+    consumers[c].join();
+  EXPECT_EQ(100000, taken.load());
+  EXPECT_EQ(5000050000LL, total.load());
+
+  // A pipeline keeps the order of its source
+  fp::types<int>::list numbers;
+  for (int i = 0; i < 10000; ++i)
+    numbers.push_back(i);
+  let squares = fp::map([](int x) { return (long long)x * x; },
+                        fp::filter([](int x) { return x % 3 == 0; }, fp::pipelined(fp::fromList(numbers), 64, 2)));
+  let expected = fp::map([](int x) { return (long long)x * x; }, fp::filter([](int x) { return x % 3 == 0; }, numbers));
+  EXPECT_EQ(2u, squares.depth());
+  EXPECT_EQ(expected, fp::list(squares));
+  EXPECT_THROW(fp::list(squares), std::logic_error);
+
+  EXPECT_EQ(500500, fp::foldl(std::plus<int>(), 0, fp::pipelined(fp::chunked(fp::map([](int x) { return x + 1; }, fp::types<int>::list(numbers.begin(), numbers.begin() + 1000)), 100))));
+
+  // A stage that throws ends the pipeline with its exception
+  let failing = fp::map([](int x) -> int { if (x == 5000) throw std::runtime_error("bad record"); return x; },
+                        fp::pipelined(fp::fromList(numbers)));
+  EXPECT_THROW(fp::list(failing), std::runtime_error);
+
+  // Reading only the start of an endless pipeline, then letting it go
+  std::function<int()> counter = [] { static std::atomic<int> n(0); return n++; };
+  {
+    let endless = fp::toStream(fp::map([](int x) { return x * 2; }, fp::pipelined(fp::chunked(counter, 32))));
+    EXPECT_EQ(fp::types<int>::list({ 0, 2, 4 }), fp::list(fp::take(3, endless)));
+  }
+}
+
+TEST(Prelude, Future) {
+  // Fan out, fan in
+  fp::types< fp::future<long long> >::list parts;
+  for (int i = 0; i < 200; ++i)
+    parts.push_back(fp::async([i]() { return (long long)i * i; }));
+  let squares = fp::sequence(parts);
+  let total   = fp::map([](const fp::types<long long>::list& l) { return fp::sum(l); }, squares);
+  EXPECT_EQ(2646700LL, total.get());
+  EXPECT_EQ(199LL * 199, squares.get().back());
+  EXPECT_TRUE(fp::sequence(fp::types< fp::future<int> >::list()).get().empty());
+
+  let answer = fp::zipWith(std::plus<int>(), fp::async([]() { return 40; }), fp::ready(2));
+  EXPECT_EQ(42, answer.get());
+  let chained = fp::then([](int x) { return fp::async([x]() { return std::to_string(x); }); }, answer);
+  EXPECT_EQ("42", chained.get());
+
+  // Failures flow through to get
+  let failed = fp::async([]() -> int { throw std::runtime_error("no value"); });
+  EXPECT_THROW(fp::map([](int x) { return x + 1; }, failed).get(), std::runtime_error);
+  EXPECT_THROW(fp::sequence(fp::types< fp::future<int> >::list({ fp::ready(1), failed })).get(), std::runtime_error);
+  EXPECT_THROW(fp::then([](int) -> fp::future<int> { throw std::logic_error("bad"); }, fp::ready(1)).get(), std::logic_error);
+
+  // Tasks that wait on tasks queued behind them, more than the pool has threads
+  fp::types< fp::future<int> >::list nested;
+  for (size_t i = 0; i < 4 * fp::sharedPool().size() + 4; ++i) {
+    nested.push_back(fp::async([]() {
+      fp::types<int> ::list inner(100);
+      fp::parallelFor(inner.size(), [&](size_t first, size_t last) {
+        for (size_t j = first; j < last; ++j) inner[j] = (int)j;
+      }, 10);
+      return fp::async([]() { return 1; }).get() + fp::sum(inner);
+    }));
+  }
+  let sums = fp::sequence(nested).get();
+  EXPECT_EQ(nested.size(), sums.size());
+  EXPECT_EQ(4951, sums.front());
+
+  // A task that waits must not pick up a task waiting on it
+  for (int i = 0; i < 100; ++i) {
+    let a = fp::async([]() { return fp::async([]() { return 1; }).get(); });
+    let b = fp::async([a]() { return a.get() + 1; });
+    EXPECT_EQ(2, b.get());
+  }
+
+  // A chunk that throws stops the rest, and nothing touches f afterwards
+  std::atomic<size_t> calls(0);
+  EXPECT_THROW(fp::parallelFor(1000, [&](size_t first, size_t) {
+    ++calls;
+    if (first == 0) throw std::runtime_error("first chunk");
+  }, 10), std::runtime_error);
+  const size_t called = calls.load();
+  fp::async([]() { return 0; }).get();
+  EXPECT_EQ(called, calls.load());
+}